@@ -0,0 +1,89 @@
+/// Walker's alias table built by Vose's method, which makes each draw O(1).
+#[derive(Clone, Debug, Default)]
+pub(crate) struct AliasTable {
+    // for column i: accept i if the 32-bit coin is less than thresholds[i],
+    // otherwise take aliases[i]. thresholds are within 0 ~ 2^32.
+    thresholds: Vec<u64>,
+    aliases: Vec<u32>,
+}
+
+impl AliasTable {
+    /// Rebuilds the table from unnormalized positive weights, reusing allocated buffers.
+    pub(crate) fn rebuild(&mut self, weights: impl ExactSizeIterator<Item = f64> + Clone) {
+        let n = weights.len();
+        assert!(n > 0 && n <= u32::MAX as usize);
+        let total: f64 = weights.clone().sum();
+
+        // scaled probabilities: average is 1.
+        let mut scaled: Vec<f64> = weights.map(|w| w * (n as f64) / total).collect();
+        let mut small = Vec::with_capacity(n);
+        let mut large = Vec::with_capacity(n);
+        for (i, &p) in scaled.iter().enumerate() {
+            if p < 1. {
+                small.push(i);
+            } else {
+                large.push(i);
+            }
+        }
+
+        self.thresholds.clear();
+        self.thresholds.resize(n, 1 << 32);
+        self.aliases.clear();
+        self.aliases.extend(0..n as u32);
+
+        while let (Some(&s), Some(&l)) = (small.last(), large.last()) {
+            small.pop();
+            self.thresholds[s] = (scaled[s] * 4294967296.) as u64;
+            self.aliases[s] = l as u32;
+            scaled[l] -= 1. - scaled[s];
+            if scaled[l] < 1. {
+                large.pop();
+                small.push(l);
+            }
+        }
+        // remaining columns (including those left by rounding errors) keep
+        // the full threshold and point to themselves.
+    }
+
+    #[inline(always)]
+    pub(crate) fn is_empty(&self) -> bool {
+        self.aliases.is_empty()
+    }
+
+    pub(crate) fn clear(&mut self) {
+        self.thresholds.clear();
+        self.aliases.clear();
+    }
+
+    /// Returns the threshold and the alias of each column.
+    pub(crate) fn columns(&self) -> impl ExactSizeIterator<Item = (u64, u32)> + '_ {
+        self.thresholds
+            .iter()
+            .copied()
+            .zip(self.aliases.iter().copied())
+    }
+
+    /// Maps 64 random bits to an index: the upper half selects the column,
+    /// the lower half is the coin.
+    #[inline(always)]
+    pub(crate) fn sample(&self, bits: u64) -> usize {
+        let col = Self::column_of(bits, self.aliases.len());
+        if Self::accepts(bits, self.thresholds[col]) {
+            col
+        } else {
+            self.aliases[col] as usize
+        }
+    }
+
+    /// Column selected by `bits` in `sample()` for a table of `n` columns.
+    #[inline(always)]
+    pub(crate) fn column_of(bits: u64, n: usize) -> usize {
+        (((bits >> 32) * n as u64) >> 32) as usize
+    }
+
+    /// Whether the coin of `bits` in `sample()` accepts the column of `threshold`.
+    #[inline(always)]
+    pub(crate) fn accepts(bits: u64, threshold: u64) -> bool {
+        (bits & 0xFFFF_FFFF) < threshold
+    }
+}
@@ -0,0 +1,125 @@
+//! Parallel batch sampling for large simulations, enabled by the `batch` feature.
+
+use crate::{rngs::ChaCha8Rng, stats::Counters, *};
+use rand::{RngCore, SeedableRng};
+use std::{
+    hash::Hash,
+    sync::atomic::{AtomicUsize, Ordering},
+    thread,
+};
+
+/// Default amount of groups in each block of `Picker::test_freqs_batch()`.
+const BLOCK_GROUPS: usize = 1 << 16;
+
+/// Options for `Picker::test_freqs_batch()`. Please construct it with
+/// `..Default::default()`, because new options may be added in the future.
+#[derive(Clone, Debug, Default)]
+pub struct BatchOptions {
+    /// Key of the ChaCha8 generator. The result only depends on it, the table,
+    /// the picking method, `amount`, `test_times` and `block_groups`.
+    pub seed: [u8; 32],
+    /// Amount of worker threads. 0 means `std::thread::available_parallelism()`.
+    pub threads: usize,
+    /// Amount of groups in each block. 0 means 65536.
+    pub block_groups: usize,
+}
+
+impl<T: Clone + Eq + Hash + Send + Sync, R: RngCore> Picker<T, R> {
+    /// Does the same thing as `test_freqs()` with draws generated in parallel,
+    /// and the result is reproducible: groups are split into blocks, and block
+    /// `i` is picked with stream `i` of `ChaCha8Rng` keyed by `options.seed`
+    /// (the block index selects the stream, i.e. the nonce, and the block
+    /// counter runs from 0 within each stream). Each block starts from a copy
+    /// of the picker's sampling state, so the result doesn't depend on the
+    /// amount of threads or the order of blocks; each worker adds counts of
+    /// its blocks into its own histogram. The random source of this `Picker`
+    /// is not used, and counters of workers are added into `stats()`.
+    ///
+    /// ```
+    /// use random_picker::{BatchOptions, Config, Picker};
+    /// let conf: Config<String> = "a=1;b=2;c=3;d=4;e=5".parse().unwrap();
+    /// let table_probs = conf.calc_probabilities(2).unwrap();
+    /// let mut picker = Picker::build(conf).unwrap();
+    /// let options = BatchOptions {
+    ///     seed: [7; 32],
+    ///     threads: 3,
+    ///     block_groups: 10_000,
+    /// };
+    /// let table_freqs = picker.test_freqs_batch(2, 1_000_000, &options).unwrap();
+    /// for (k, v) in table_freqs.iter() {
+    ///     assert!((*v - *table_probs.get(k).unwrap()).abs() < 0.005);
+    /// }
+    ///
+    /// let options_1 = BatchOptions { threads: 1, ..options };
+    /// assert_eq!(picker.test_freqs_batch(2, 1_000_000, &options_1).unwrap(), table_freqs);
+    /// #[cfg(feature = "stats")] // 2 draws at least for each group
+    /// assert!(picker.stats().draws >= 2 * 2 * 1_000_000);
+    /// ```
+    pub fn test_freqs_batch(
+        &mut self,
+        amount: usize,
+        test_times: usize,
+        options: &BatchOptions,
+    ) -> Result<Table<T>, Error> {
+        if !self.table().repetitive() && amount > self.table_len() {
+            return Err(Error::InvalidAmount);
+        }
+        let block_groups = if options.block_groups > 0 {
+            options.block_groups
+        } else {
+            BLOCK_GROUPS
+        };
+        let cnt_blocks = test_times.div_ceil(block_groups);
+        let threads = if options.threads > 0 {
+            options.threads
+        } else {
+            thread::available_parallelism()
+                .map(|n| n.get())
+                .unwrap_or(4)
+        };
+        let threads = threads.min(cnt_blocks.max(1));
+
+        // sampling structures are prepared once, then shared by copies of `template`
+        self.prepare_sampler();
+        let template = self.with_rng(ChaCha8Rng::from_seed(options.seed));
+        let next_block = AtomicUsize::new(0);
+        let mut tbl_freq = vec![0_usize; self.table_len()];
+        thread::scope(|s| {
+            let thread_hdls: Vec<_> = (0..threads)
+                .map(|_| {
+                    let (template, next_block) = (&template, &next_block);
+                    s.spawn(move || {
+                        let mut tbl_freq = vec![0_usize; template.table_len()];
+                        let mut counters = Counters::default();
+                        loop {
+                            let i_block = next_block.fetch_add(1, Ordering::Relaxed);
+                            if i_block >= cnt_blocks {
+                                break;
+                            }
+                            let mut rng = ChaCha8Rng::from_seed(options.seed);
+                            rng.set_stream(i_block as u64);
+                            let mut picker = template.with_rng(rng);
+                            let start = i_block * block_groups;
+                            let times = block_groups.min(test_times - start);
+                            let sub_freq = picker.count_freqs(amount, times);
+                            counters.add(&picker.counters);
+                            for (v, sub) in tbl_freq.iter_mut().zip(sub_freq?) {
+                                *v += sub;
+                            }
+                        }
+                        Ok((tbl_freq, counters))
+                    })
+                })
+                .collect();
+            for hdl in thread_hdls {
+                let (sub_freq, counters) = hdl.join().map_err(|_| Error::ThreadError)??;
+                self.counters.add(&counters);
+                for (v, sub) in tbl_freq.iter_mut().zip(sub_freq) {
+                    *v += sub;
+                }
+            }
+            Ok(())
+        })?;
+        Ok(self.freq_table(&tbl_freq, test_times))
+    }
+}
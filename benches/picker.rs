@@ -0,0 +1,288 @@
+//! Benchmarks of `Picker` and the probability calculator, parameterized over
+//! table size, skew of weights, `repetitive` and `pick_amount`.
+//!
+//! ```text
+//! cargo bench --bench picker -- [filter] [--save-baseline <name>] [--baseline <name>]
+//! ```
+//!
+//! Each case runs for about `SAMPLES * SAMPLE_TIME`, and the median time per
+//! iteration is printed. Random sources are seeded with fixed values, so that
+//! every run does the same work. `--save-baseline` saves results into
+//! `target/bench-baselines/<name>.csv`; `--baseline` compares results with
+//! a saved baseline, so that changes can be measured between commits:
+//!
+//! ```text
+//! git checkout main && cargo bench --bench picker -- --save-baseline main
+//! git checkout feature && cargo bench --bench picker -- --baseline main
+//! ```
+
+use rand::SeedableRng;
+use random_picker::{rngs::Xoshiro256PlusPlus, *};
+use std::{
+    collections::HashMap,
+    fs,
+    hint::black_box,
+    path::PathBuf,
+    time::{Duration, Instant},
+};
+
+const WARM_UP_TIME: Duration = Duration::from_millis(100);
+const SAMPLE_TIME: Duration = Duration::from_millis(20);
+const SAMPLES: usize = 15;
+
+const TABLE_LENS: [usize; 3] = [16, 1024, 65536];
+
+#[derive(Clone, Copy)]
+enum Skew {
+    Flat,
+    Linear,
+    Zipf,
+}
+
+impl Skew {
+    const ALL: [Skew; 3] = [Skew::Flat, Skew::Linear, Skew::Zipf];
+
+    fn name(&self) -> &'static str {
+        match self {
+            Skew::Flat => "flat",
+            Skew::Linear => "linear",
+            Skew::Zipf => "zipf",
+        }
+    }
+
+    fn weight(&self, i: usize) -> f64 {
+        match self {
+            Skew::Flat => 1.,
+            Skew::Linear => (i + 1) as f64,
+            Skew::Zipf => 1. / ((i + 1) as f64).powf(1.2),
+        }
+    }
+}
+
+fn config(table_len: usize, skew: Skew, repetitive: bool) -> Config<String> {
+    let mut conf = Config::new();
+    for i in 0..table_len {
+        conf.table.insert(format!("item{i}"), skew.weight(i));
+    }
+    conf.repetitive = repetitive;
+    conf
+}
+
+fn build_picker(conf: Config<String>) -> Picker<String, Xoshiro256PlusPlus> {
+    Picker::build_with_rng(conf, Xoshiro256PlusPlus::seed_from_u64(1)).unwrap()
+}
+
+struct Bencher {
+    filter: Option<String>,
+    save_baseline: Option<String>,
+    baseline: HashMap<String, f64>,
+    results: Vec<(String, f64)>,
+}
+
+impl Bencher {
+    fn from_args() -> Self {
+        let mut bencher = Self {
+            filter: None,
+            save_baseline: None,
+            baseline: HashMap::new(),
+            results: Vec::new(),
+        };
+        let mut args = std::env::args().skip(1);
+        while let Some(arg) = args.next() {
+            match &arg as &str {
+                "--save-baseline" => bencher.save_baseline = args.next(),
+                "--baseline" => {
+                    let name = args.next().expect("Baseline name is not given");
+                    let path = baseline_path(&name);
+                    let csv = fs::read_to_string(&path)
+                        .unwrap_or_else(|_| panic!("Failed to read {}", path.display()));
+                    bencher.baseline = (csv.lines().skip(1))
+                        .filter_map(|line| line.rsplit_once(','))
+                        .filter_map(|(name, ns)| Some((name.to_string(), ns.parse().ok()?)))
+                        .collect();
+                }
+                "--bench" => (), // passed by `cargo bench`
+                _ if arg.starts_with("--") => (),
+                _ => bencher.filter = Some(arg),
+            }
+        }
+        bencher
+    }
+
+    /// Measures `f` if `name` matches the filter. `f` is called with the amount of
+    /// iterations, and it returns the time cost of them (excluding preparation).
+    fn measure<F: FnMut(usize) -> Duration>(&mut self, name: &str, mut f: F) {
+        if let Some(filter) = &self.filter {
+            if !name.contains(filter.as_str()) {
+                return;
+            }
+        }
+
+        // warm up, and find the amount of iterations for each sample
+        let mut iters = 1;
+        let t_start = Instant::now();
+        let mut per_iter = loop {
+            let elapsed = f(iters);
+            if t_start.elapsed() >= WARM_UP_TIME {
+                break elapsed.as_secs_f64() / iters as f64;
+            }
+            if elapsed < SAMPLE_TIME / 10 {
+                iters *= 2;
+            }
+        };
+        iters = ((SAMPLE_TIME.as_secs_f64() / per_iter) as usize).max(1);
+
+        let mut samples: Vec<f64> = (0..SAMPLES)
+            .map(|_| f(iters).as_secs_f64() * 1e9 / iters as f64)
+            .collect();
+        samples.sort_by(f64::total_cmp);
+        per_iter = samples[SAMPLES / 2];
+        let mut deviations: Vec<f64> = samples.iter().map(|v| (v - per_iter).abs()).collect();
+        deviations.sort_by(f64::total_cmp);
+        let mad = deviations[SAMPLES / 2] / per_iter * 100.;
+
+        let change = if let Some(&prev) = self.baseline.get(name) {
+            format!("{:+7.2}%", (per_iter / prev - 1.) * 100.)
+        } else {
+            String::new()
+        };
+        println!(
+            "{name:<48} {:>14} (±{mad:.1}%) {change}",
+            fmt_time(per_iter)
+        );
+        self.results.push((name.to_string(), per_iter));
+    }
+
+    fn finish(self) {
+        let Some(name) = self.save_baseline else {
+            return;
+        };
+        let path = baseline_path(&name);
+        let mut csv = String::from("name,ns_per_iter\n");
+        for (name, ns) in &self.results {
+            csv += &format!("{name},{ns}\n");
+        }
+        let _ = fs::create_dir_all(path.parent().unwrap());
+        fs::write(&path, csv).expect("Failed to save the baseline");
+        println!("Saved baseline: {}", path.display());
+    }
+}
+
+/// `target/bench-baselines/<name>.csv`, in which `target` is found from the
+/// path of this executable (`target/release/deps/picker-*`).
+fn baseline_path(name: &str) -> PathBuf {
+    let exe = std::env::current_exe().unwrap();
+    let target = exe.ancestors().nth(3).unwrap();
+    target.join("bench-baselines").join(format!("{name}.csv"))
+}
+
+fn fmt_time(ns: f64) -> String {
+    if ns < 1e3 {
+        format!("{ns:.2} ns")
+    } else if ns < 1e6 {
+        format!("{:.2} us", ns / 1e3)
+    } else {
+        format!("{:.2} ms", ns / 1e6)
+    }
+}
+
+fn main() {
+    let mut b = Bencher::from_args();
+
+    for table_len in TABLE_LENS {
+        for skew in Skew::ALL {
+            let case = format!("n={table_len}/{}", skew.name());
+
+            for repetitive in [true, false] {
+                for amount in [1, 16] {
+                    let mut picker = build_picker(config(table_len, skew, repetitive));
+                    let name = format!("pick/{case}/rep={repetitive}/k={amount}");
+                    b.measure(&name, |iters| {
+                        let t = Instant::now();
+                        for _ in 0..iters {
+                            black_box(picker.pick(amount).unwrap());
+                        }
+                        t.elapsed()
+                    });
+                }
+            }
+
+            let mut picker = build_picker(config(table_len, skew, true));
+            let mut dest = vec![String::new(); 1024];
+            b.measure(&format!("write_to/{case}/rep=true/k=1024"), |iters| {
+                let t = Instant::now();
+                for _ in 0..iters {
+                    picker.write_to(&mut dest).unwrap();
+                    black_box(&dest);
+                }
+                t.elapsed()
+            });
+
+            let conf = config(table_len, skew, false);
+            let mut picker = build_picker(conf.clone());
+            b.measure(&format!("configure/{case}"), |iters| {
+                let confs = vec![conf.clone(); iters];
+                let t = Instant::now();
+                for conf in confs {
+                    picker.configure(conf).unwrap();
+                }
+                t.elapsed()
+            });
+        }
+
+        for repetitive in [true, false] {
+            let mut picker = build_picker(config(table_len, Skew::Linear, repetitive));
+            let name = format!("test_freqs/n={table_len}/linear/rep={repetitive}/k=4");
+            b.measure(&name, |iters| {
+                let t = Instant::now();
+                for _ in 0..iters {
+                    black_box(picker.test_freqs(4, 10_000).unwrap());
+                }
+                t.elapsed()
+            });
+        }
+    }
+
+    for (table_len, amount) in [(12, 3), (16, 4), (20, 5), (100, 3)] {
+        for skew in [Skew::Linear, Skew::Zipf] {
+            let conf = config(table_len, skew, false);
+            for precision in [CalcPrecision::Fast, CalcPrecision::Compensated] {
+                let name = format!(
+                    "calc/tree/n={table_len}/{}/k={amount}/{precision:?}",
+                    skew.name()
+                );
+                let options = CalcOptions {
+                    threads: 1,
+                    precision,
+                    ..Default::default()
+                };
+                b.measure(&name, |iters| {
+                    let t = Instant::now();
+                    for _ in 0..iters {
+                        black_box(conf.calc_probabilities_with(amount, &options).unwrap());
+                    }
+                    t.elapsed()
+                });
+            }
+        }
+    }
+
+    for (table_len, amount) in [(100, 10), (500, 50)] {
+        let conf = config(table_len, Skew::Zipf, false);
+        let name = format!("calc/integral/n={table_len}/zipf/k={amount}");
+        let options = CalcOptions {
+            threads: 1,
+            engine: CalcEngine::Integral,
+            ..Default::default()
+        };
+        b.measure(&name, |iters| {
+            let t = Instant::now();
+            for _ in 0..iters {
+                black_box(conf.calc_probabilities_with(amount, &options).unwrap());
+            }
+            t.elapsed()
+        });
+    }
+
+    b.finish();
+}
@@ -0,0 +1,42 @@
+/// Packed set of flags of table items, used as `table_picked` in `Picker`.
+#[derive(Clone, Debug, Default)]
+pub(crate) struct BitSet {
+    words: Vec<u64>,
+}
+
+impl BitSet {
+    /// Creates the set of `len` flags which are all unset.
+    pub(crate) fn new(len: usize) -> Self {
+        let mut bit_set = Self::default();
+        bit_set.resize_clear(len);
+        bit_set
+    }
+
+    /// Changes the length and unsets all flags.
+    pub(crate) fn resize_clear(&mut self, len: usize) {
+        self.words.clear();
+        self.words.resize(len.div_ceil(64), 0);
+    }
+
+    /// Changes the length; flags may be left set (`clear()` is required before use).
+    #[inline(always)]
+    pub(crate) fn resize(&mut self, len: usize) {
+        self.words.resize(len.div_ceil(64), 0);
+    }
+
+    /// Unsets all flags, which costs 1/64 of clearing a `Vec<bool>`.
+    #[inline(always)]
+    pub(crate) fn clear(&mut self) {
+        self.words.fill(0);
+    }
+
+    #[inline(always)]
+    pub(crate) fn get(&self, i: usize) -> bool {
+        self.words[i / 64] & (1 << (i % 64)) != 0
+    }
+
+    #[inline(always)]
+    pub(crate) fn set(&mut self, i: usize) {
+        self.words[i / 64] |= 1 << (i % 64);
+    }
+}
@@ -0,0 +1,272 @@
+use crate::*;
+use std::{
+    collections::HashMap,
+    fs,
+    hash::Hash,
+    io,
+    path::PathBuf,
+    sync::{
+        atomic::{AtomicU64, Ordering},
+        Arc, Mutex,
+    },
+};
+
+/// Magic bytes at the beginning of each cache file.
+const FILE_MAGIC: &[u8; 4] = b"RPPC";
+/// Version of the cache file format, increased on incompatible changes.
+const FILE_VERSION: u64 = 1;
+
+/// Cache of results of the probability calculator, used by
+/// `Config::calc_probabilities_cached()`. Results are kept in memory,
+/// and optionally in a directory, so that they survive across processes.
+///
+/// An entry is keyed by `pick_amount` and the sorted multiset of normalized
+/// weights (`inversed` is applied before normalization), so it is reused by
+/// tables whose item names are permuted or different, and by tables whose
+/// weights are multiplied by a common factor (up to floating-point rounding
+/// of the normalization). The cache is shared between threads by reference.
+///
+/// ```
+/// use random_picker::{CalcOptions, Config, ProbCache};
+/// let cache = ProbCache::new();
+/// let options = CalcOptions::default();
+/// let conf: Config<String> = "a=1;b=2;c=3;d=4;e=5;f=6".parse().unwrap();
+/// let probs = conf.calc_probabilities_cached(3, &options, &cache).unwrap();
+/// assert_eq!((cache.hits(), cache.misses()), (0, 1));
+///
+/// let conf: Config<String> = "u=6;v=5;w=4;x=3;y=2;z=1".parse().unwrap();
+/// let probs_perm = conf.calc_probabilities_cached(3, &options, &cache).unwrap();
+/// assert_eq!((cache.hits(), cache.misses()), (1, 1));
+/// assert_eq!(probs["a"], probs_perm["z"]);
+/// assert_eq!(probs["f"], probs_perm["u"]);
+/// ```
+#[derive(Debug, Default)]
+pub struct ProbCache {
+    entries: Mutex<HashMap<CacheKey, Arc<[f64]>>>,
+    dir: Option<PathBuf>,
+    hits: AtomicU64,
+    misses: AtomicU64,
+}
+
+#[derive(Clone, PartialEq, Eq, Hash, Debug)]
+struct CacheKey {
+    pick_amount: usize,
+    weight_bits: Box<[u64]>, // sorted normalized weights in ascending order
+}
+
+impl ProbCache {
+    /// Creates an empty in-memory cache.
+    #[inline]
+    pub fn new() -> Self {
+        Self::default()
+    }
+
+    /// Creates a cache which also stores each entry as a file in `dir`,
+    /// and loads entries saved there by other processes on demand.
+    /// The directory is created if it doesn't exist. Failures of reading
+    /// or writing cache files after this are ignored, with the result
+    /// being calculated (or only kept in memory) instead.
+    ///
+    /// ```
+    /// use random_picker::{CalcOptions, Config, ProbCache};
+    /// let dir = std::env::temp_dir().join("random-picker-doctest-cache");
+    /// let conf: Config<String> = "a=1;b=2;c=3;d=4;e=5".parse().unwrap();
+    /// let options = CalcOptions::default();
+    /// let probs = {
+    ///     let cache = ProbCache::with_dir(&dir).unwrap();
+    ///     conf.calc_probabilities_cached(2, &options, &cache).unwrap()
+    /// };
+    /// let cache = ProbCache::with_dir(&dir).unwrap();
+    /// let probs_loaded = conf.calc_probabilities_cached(2, &options, &cache).unwrap();
+    /// assert_eq!(cache.hits(), 1);
+    /// assert_eq!(probs, probs_loaded);
+    /// # std::fs::remove_dir_all(&dir).unwrap();
+    /// ```
+    pub fn with_dir(dir: impl Into<PathBuf>) -> io::Result<Self> {
+        let dir = dir.into();
+        fs::create_dir_all(&dir)?;
+        Ok(Self {
+            dir: Some(dir),
+            ..Self::default()
+        })
+    }
+
+    /// Returns the amount of entries in memory.
+    #[inline]
+    pub fn len(&self) -> usize {
+        self.entries.lock().unwrap().len()
+    }
+
+    /// Checks whether or not there is no entry in memory.
+    #[inline]
+    pub fn is_empty(&self) -> bool {
+        self.len() == 0
+    }
+
+    /// Removes all entries in memory. Files in the cache directory are kept.
+    #[inline]
+    pub fn clear(&self) {
+        self.entries.lock().unwrap().clear();
+    }
+
+    /// Returns the amount of lookups found in memory or in the cache directory.
+    #[inline]
+    pub fn hits(&self) -> u64 {
+        self.hits.load(Ordering::Relaxed)
+    }
+
+    /// Returns the amount of lookups that required calculation.
+    #[inline]
+    pub fn misses(&self) -> u64 {
+        self.misses.load(Ordering::Relaxed)
+    }
+
+    fn get(&self, key: &CacheKey) -> Option<Arc<[f64]>> {
+        if let Some(probs) = self.entries.lock().unwrap().get(key) {
+            return Some(probs.clone());
+        }
+        let probs: Arc<[f64]> = self.load(key)?.into();
+        (self.entries.lock().unwrap()).insert(key.clone(), probs.clone());
+        Some(probs)
+    }
+
+    fn insert(&self, key: CacheKey, probs: Arc<[f64]>) {
+        self.save(&key, &probs);
+        self.entries.lock().unwrap().insert(key, probs);
+    }
+
+    /// File format (little-endian): magic, version (u64), `pick_amount` (u64),
+    /// table length `n` (u64), `n` weight bits (u64), `n` probabilities (f64).
+    /// The key is stored to rule out collisions of the file name hash.
+    fn load(&self, key: &CacheKey) -> Option<Vec<f64>> {
+        let bytes = fs::read(self.file_path(key)?).ok()?;
+        let mut words = bytes.strip_prefix(FILE_MAGIC)?.chunks_exact(8);
+        let mut next = || Some(u64::from_le_bytes(words.next()?.try_into().ok()?));
+        let header = next()?;
+        let n = key.weight_bits.len();
+        if header != FILE_VERSION || next()? != key.pick_amount as u64 || next()? != n as u64 {
+            return None;
+        }
+        for &bits in key.weight_bits.iter() {
+            if next()? != bits {
+                return None;
+            }
+        }
+        (0..n).map(|_| next().map(f64::from_bits)).collect()
+    }
+
+    fn save(&self, key: &CacheKey, probs: &[f64]) {
+        let Some(path) = self.file_path(key) else {
+            return;
+        };
+        let n = key.weight_bits.len();
+        let mut bytes = Vec::with_capacity(4 + 8 * (3 + 2 * n));
+        bytes.extend_from_slice(FILE_MAGIC);
+        let words = [FILE_VERSION, key.pick_amount as u64, n as u64];
+        let words = words.into_iter().chain(key.weight_bits.iter().copied());
+        for word in words.chain(probs.iter().map(|p| p.to_bits())) {
+            bytes.extend_from_slice(&word.to_le_bytes());
+        }
+        // write into a temporary file then rename it, so that other processes
+        // never read a partially written file.
+        let path_tmp = path.with_extension(format!("tmp{}", std::process::id()));
+        if fs::write(&path_tmp, bytes).is_ok() && fs::rename(&path_tmp, &path).is_err() {
+            let _ = fs::remove_file(&path_tmp);
+        }
+    }
+
+    fn file_path(&self, key: &CacheKey) -> Option<PathBuf> {
+        let dir = self.dir.as_ref()?;
+        Some(dir.join(format!("{:016x}.bin", key.fingerprint())))
+    }
+}
+
+impl CacheKey {
+    /// FNV-1a hash of the key, which is stable across builds and platforms
+    /// (unlike `DefaultHasher`), for naming cache files.
+    fn fingerprint(&self) -> u64 {
+        let mut hash: u64 = 0xcbf2_9ce4_8422_2325;
+        let words = std::iter::once(self.pick_amount as u64);
+        for word in words.chain(self.weight_bits.iter().copied()) {
+            for byte in word.to_le_bytes() {
+                hash ^= byte as u64;
+                hash = hash.wrapping_mul(0x0100_0000_01b3);
+            }
+        }
+        hash
+    }
+}
+
+impl<T: Clone + Eq + Hash> Config<T> {
+    /// Does the same thing as `calc_probabilities_with()`, but looks up the
+    /// result in `cache` first, and stores the calculated result into it.
+    /// Only the general non-repetitive case is cached; other cases cost O(n)
+    /// and are calculated directly. The cached result may come from another
+    /// `CalcEngine` than the one given in `options`.
+    ///
+    /// ```
+    /// use random_picker::{CalcOptions, Config, ProbCache};
+    /// let (cache, options) = (ProbCache::new(), CalcOptions::default());
+    /// // items of zero weights are never picked up
+    /// let conf: Config<String> = "a=1;b=2;c=3;d=0;e=0".parse().unwrap();
+    /// for pick_amount in 0..=4 {
+    ///     let probs = conf.calc_probabilities(pick_amount).unwrap();
+    ///     let probs_cached = conf
+    ///         .calc_probabilities_cached(pick_amount, &options, &cache)
+    ///         .unwrap();
+    ///     assert_eq!(probs.len(), probs_cached.len());
+    ///     for (k, v) in probs.iter() {
+    ///         assert!((v - probs_cached[k]).abs() < 1e-12);
+    ///     }
+    /// }
+    /// assert_eq!(cache.misses(), 1); // only `pick_amount` of 2 is cached
+    /// ```
+    pub fn calc_probabilities_cached(
+        &self,
+        pick_amount: usize,
+        options: &CalcOptions,
+        cache: &ProbCache,
+    ) -> Result<Table<T>, Error> {
+        if self.repetitive || pick_amount <= 1 || self.is_fair() {
+            return self.calc_probabilities_with(pick_amount, options);
+        }
+
+        // items of zero weights are dropped here
+        let mut table = self.vec_table()?;
+        if pick_amount >= table.len() {
+            return self.calc_probabilities_with(pick_amount, options);
+        }
+        table.sort_unstable_by(|(_, a), (_, b)| a.total_cmp(b));
+        let grid_width: f64 = table.iter().map(|(_, v)| v).sum();
+        let key = CacheKey {
+            pick_amount,
+            weight_bits: table
+                .iter()
+                .map(|(_, v)| (v / grid_width).to_bits())
+                .collect(),
+        };
+
+        let probs = if let Some(probs) = cache.get(&key) {
+            cache.hits.fetch_add(1, Ordering::Relaxed);
+            probs
+        } else {
+            cache.misses.fetch_add(1, Ordering::Relaxed);
+            let conf = Config {
+                table: (key.weight_bits.iter().enumerate())
+                    .map(|(i, &bits)| (i, f64::from_bits(bits)))
+                    .collect(),
+                inversed: false,
+                repetitive: false,
+            };
+            let result = conf.calc_probabilities_with(pick_amount, options)?;
+            let probs: Arc<[f64]> = (0..table.len()).map(|i| result[&i]).collect();
+            cache.insert(key, probs.clone());
+            probs
+        };
+        Ok(table
+            .into_iter()
+            .zip(probs.iter())
+            .map(|((k, _), &p)| (k, p))
+            .collect())
+    }
+}
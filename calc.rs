@@ -1,21 +1,76 @@
-use crate::*;
-use std::{hash::Hash, thread};
+use crate::{integral::calc_integral, *};
+use std::{
+    collections::HashMap,
+    hash::Hash,
+    sync::{
+        atomic::{AtomicBool, AtomicU64, AtomicUsize, Ordering},
+        Arc, Mutex,
+    },
+    thread,
+    time::{Duration, Instant},
+};
+
+/// Amount of nodes visited by a worker between two updates of `CalcProgress`.
+const NODES_PER_REPORT: u64 = 1 << 16;
+/// Amount of nodes for each item between two flushes of partial sums in
+/// `CalcPrecision::Compensated` mode.
+const FLUSH_NODES_PER_ITEM: usize = 16;
 
 impl<T: Clone + Eq + Hash> Config<T> {
     /// Calculates probabilities of existences of table items in each picking result
     /// of length `pick_amount`. In non-repetitive mode, the multi-thread tree algorithm
-    /// may be used.
+    /// may be used: subtrees are queued as tasks for a pool of worker threads,
+    /// whose size does not exceed `std::thread::available_parallelism()`.
     ///
-    /// Preorder traversal is performed in each thread. Something like depth-first or
-    /// postorder algorithm may achieve higher precision (consider the error produced
-    /// while adding a small floating-point number to a much larger number, which is
-    /// the current way), but it will probably increase complexity and memory usage.
+    /// Preorder traversal is performed in each thread, and the probability of each
+    /// node is added into a much larger sum, which loses low-order digits. Pass
+    /// `CalcPrecision::Compensated` to `calc_probabilities_with()` if they matter.
     ///
     /// TODO: figure out why its single-thread performance is about 7% slower than
     /// the single-thread C++ version compiled with `clang++` without `-march=native`,
     /// and unsafe operations can't make this Rust program faster.
     /// It is faster than the C++ version compiled with GCC, though.
+    #[inline(always)]
     pub fn calc_probabilities(&self, pick_amount: usize) -> Result<Table<T>, Error> {
+        self.calc_probabilities_with(pick_amount, &CalcOptions::default())
+    }
+
+    /// Does the same thing as `calc_probabilities()` with given options.
+    ///
+    /// ```
+    /// use random_picker::{CalcOptions, Config};
+    /// let conf: Config<String> = "a=1;b=2;c=3;d=4;e=5;f=6".parse().unwrap();
+    /// let probs = conf.calc_probabilities(4).unwrap();
+    /// let options = CalcOptions {
+    ///     threads: 3,
+    ///     split_depth: 2,
+    ///     ..Default::default()
+    /// };
+    /// let probs_split = conf.calc_probabilities_with(4, &options).unwrap();
+    /// for (k, v) in probs.iter() {
+    ///     assert!((*v - *probs_split.get(k).unwrap()).abs() < 1e-12);
+    /// }
+    ///
+    /// let options = CalcOptions {
+    ///     engine: random_picker::CalcEngine::Integral,
+    ///     ..Default::default()
+    /// };
+    /// let probs_int = conf.calc_probabilities_with(4, &options).unwrap();
+    /// for (k, v) in probs.iter() {
+    ///     assert!((*v - *probs_int.get(k).unwrap()).abs() < 1e-12);
+    /// }
+    ///
+    /// // items of zero weights are never picked up
+    /// let conf: Config<String> = "a=1;b=2;c=0;d=0".parse().unwrap();
+    /// let probs = conf.calc_probabilities_with(3, &options).unwrap();
+    /// assert_eq!(probs.len(), 2);
+    /// assert_eq!((probs["a"], probs["b"]), (1., 1.));
+    /// ```
+    pub fn calc_probabilities_with(
+        &self,
+        pick_amount: usize,
+        options: &CalcOptions,
+    ) -> Result<Table<T>, Error> {
         if pick_amount == 0 {
             return Ok(self.table.keys().map(|k| (k.clone(), 0.)).collect());
         }
@@ -46,6 +101,10 @@ impl<T: Clone + Eq + Hash> Config<T> {
         if pick_amount == 1 {
             return Ok(table.into_iter().collect());
         }
+        if !self.repetitive && pick_amount >= table.len() {
+            // all items of nonzero weights are picked up
+            return Ok(table.into_iter().map(|(k, _)| (k, 1.)).collect());
+        }
         if self.repetitive {
             return Ok(table
                 .into_iter()
@@ -56,105 +115,580 @@ impl<T: Clone + Eq + Hash> Config<T> {
         // -------- calc for general non-repetitive cases --------
 
         let table_val: Vec<_> = table.iter().map(|(_, v)| *v).collect();
-        let mut calc_result = table.clone();
-
-        let cnt_threads = thread::available_parallelism()
-            .map(|n| n.get())
-            .unwrap_or(4)
-            .max(table.len());
-        let cnt_calc_groups = table.len().div_ceil(cnt_threads);
-        let mut calc_groups = Vec::with_capacity(cnt_calc_groups);
-        let mut table_picked = vec![false; table.len()];
-        for i in 0..cnt_calc_groups {
-            let mut calcs = Vec::with_capacity(cnt_threads);
-            for j in 0..cnt_threads {
-                let i_th = i * cnt_threads + j;
-                if i_th >= table.len() {
-                    break;
-                }
-                table_picked[i_th] = true;
-                let calc_stack =
-                    CalcStack::new(table_val.clone(), pick_amount, table_picked.clone());
-                calcs.push((i_th, Some(calc_stack)));
-                table_picked[i_th] = false;
+        let progress = options.progress.as_deref();
+        if let Some(progress) = progress {
+            progress.start();
+        }
+        let calc_result = match options.engine {
+            CalcEngine::Tree => calc_tree(&table_val, pick_amount, options)?,
+            CalcEngine::Integral => {
+                calc_integral(&table_val, pick_amount, options.cnt_threads(), progress)?
             }
-            calc_groups.push(calcs);
+        };
+        Ok(table
+            .into_iter()
+            .zip(calc_result)
+            .map(|((k, _), v)| (k, v))
+            .collect())
+    }
+}
+
+/// Algorithm used by the probability calculator in the general non-repetitive case.
+#[derive(Clone, Copy, PartialEq, Eq, Debug, Default)]
+pub enum CalcEngine {
+    /// Exhaustive traversal of the tree of all possible picking sequences:
+    /// exact (limited by floating-point errors), but the amount of nodes grows
+    /// combinatorially with table length and `pick_amount`. Items of equal
+    /// weights are traversed as one node, so it grows with the amount of
+    /// distinct weights instead if there are only a few of them.
+    ///
+    /// ```
+    /// use random_picker::Config;
+    /// // 3 distinct weights: about 3^10 nodes instead of 90^10
+    /// let conf: Config<usize> = Config {
+    ///     table: (0..90).map(|i| (i, [1., 2., 4.][i % 3])).collect(),
+    ///     inversed: false,
+    ///     repetitive: false,
+    /// };
+    /// let probs = conf.calc_probabilities(10).unwrap();
+    /// assert!((probs.values().sum::<f64>() - 10.).abs() < 1e-12);
+    /// assert_eq!(probs[&0], probs[&87]);
+    /// assert!(probs[&0] < probs[&1] && probs[&1] < probs[&2]);
+    /// ```
+    #[default]
+    Tree,
+    /// Numeric integration of the exponential-clock formulation, with the
+    /// absolute error controlled under about 1e-12. It costs about
+    /// O(n * pick_amount) for each of thousands of integration nodes, which
+    /// is practical for tables of hundreds of items.
+    Integral,
+}
+
+/// Summation mode of `CalcEngine::Tree`.
+///
+/// ```
+/// use random_picker::{CalcOptions, CalcPrecision, Config};
+/// let conf: Config<usize> = Config {
+///     table: (0..60).map(|i| (i, 1. / (i + 1) as f64)).collect(),
+///     inversed: false,
+///     repetitive: false,
+/// };
+/// let calc = |split_depth| {
+///     let options = CalcOptions {
+///         threads: 2,
+///         split_depth,
+///         precision: CalcPrecision::Compensated,
+///         ..Default::default()
+///     };
+///     conf.calc_probabilities_with(3, &options).unwrap()
+/// };
+/// // the order of summation doesn't affect low-order digits
+/// let (probs_1, probs_2) = (calc(1), calc(2));
+/// for (k, v) in probs_1.iter() {
+///     assert!((v - probs_2[k]).abs() <= 4. * f64::EPSILON * v);
+/// }
+/// ```
+#[derive(Clone, Copy, PartialEq, Eq, Debug, Default)]
+pub enum CalcPrecision {
+    /// Probabilities of nodes are added directly into results. The relative
+    /// error grows with the amount of nodes, because small probabilities are
+    /// added into much larger sums (it is about 1e-13 for millions of nodes).
+    #[default]
+    Fast,
+    /// Probabilities are added into partial sums, which are added into results
+    /// by Kahan summation every few dozen nodes for each item, and the remaining
+    /// weight of unpicked items is restored exactly while going up the tree.
+    /// The error is kept at a few units of the last place regardless of the
+    /// amount of nodes, and it is up to about 10% slower.
+    Compensated,
+}
+
+/// Options for `Config::calc_probabilities_with()`. Please construct it with
+/// `..Default::default()`, because new options may be added in the future.
+#[derive(Clone, Debug, Default)]
+pub struct CalcOptions {
+    /// Amount of worker threads. 0 means `std::thread::available_parallelism()`.
+    pub threads: usize,
+    /// Depth of the tree at which the traversal is split into tasks for worker
+    /// threads (there are `n * (n - 1) * ...` tasks for depth 1, 2, ..., or fewer
+    /// if some items have equal weights).
+    /// It is clamped to `1 ..= pick_amount - 1`. 0 means choosing the smallest
+    /// depth that produces enough tasks to keep all workers busy.
+    pub split_depth: usize,
+    /// Algorithm used in the general non-repetitive case.
+    pub engine: CalcEngine,
+    /// Summation mode of `CalcEngine::Tree` (ignored by `CalcEngine::Integral`).
+    pub precision: CalcPrecision,
+    /// Handle for reading the progress or cancelling the calculation from
+    /// other threads. It is only updated in the general non-repetitive case.
+    pub progress: Option<Arc<CalcProgress>>,
+}
+
+impl CalcOptions {
+    fn cnt_threads(&self) -> usize {
+        if self.threads > 0 {
+            self.threads
+        } else {
+            thread::available_parallelism()
+                .map(|n| n.get())
+                .unwrap_or(4)
         }
+    }
+}
 
-        for group in calc_groups.into_iter() {
-            let mut thread_hdls = Vec::with_capacity(cnt_threads);
-            for (i, mut calc) in group.into_iter() {
-                let calc = calc.take().unwrap();
-                thread_hdls.push(thread::spawn(move || (i, calc.calc())));
-            }
-            for hdl in thread_hdls {
-                let (i_th, sub_result) = hdl.join().map_err(|_| Error::ThreadError)?;
-                for (i, &sub_prob) in sub_result.iter().enumerate() {
-                    calc_result[i].1 += table_val[i_th] * sub_prob;
-                }
+/// Progress of a calculation, shared by the caller and the calculator through
+/// `CalcOptions::progress`. The calculation can be cancelled by `cancel()`,
+/// then `Error::Cancelled` is returned as soon as each worker thread notices
+/// it (in a few milliseconds), and all worker threads are joined before returning.
+///
+/// ```
+/// use random_picker::{CalcOptions, CalcProgress, Config, Error};
+/// use std::sync::Arc;
+/// let conf: Config<String> = "a=1;b=2;c=3;d=4;e=5;f=6;g=7;h=8;i=9;j=10;k=11;l=12"
+///     .parse()
+///     .unwrap();
+/// let progress = Arc::new(CalcProgress::new());
+/// let options = CalcOptions {
+///     progress: Some(progress.clone()),
+///     ..Default::default()
+/// };
+/// conf.calc_probabilities_with(5, &options).unwrap();
+/// assert_eq!(progress.fraction(), 1.);
+/// assert!(progress.nodes_visited() > 0);
+///
+/// progress.cancel();
+/// let result = conf.calc_probabilities_with(5, &options);
+/// assert!(matches!(result, Err(Error::Cancelled)));
+/// ```
+#[derive(Debug, Default)]
+pub struct CalcProgress {
+    tasks_total: AtomicUsize,
+    tasks_done: AtomicUsize,
+    nodes_visited: AtomicU64,
+    cancelled: AtomicBool,
+    time_start: Mutex<Option<Instant>>,
+}
+
+impl CalcProgress {
+    #[inline(always)]
+    pub fn new() -> Self {
+        Self::default()
+    }
+
+    /// Requests the calculation to stop. It also affects later calculations
+    /// using this handle.
+    #[inline(always)]
+    pub fn cancel(&self) {
+        self.cancelled.store(true, Ordering::Relaxed);
+    }
+
+    #[inline(always)]
+    pub fn is_cancelled(&self) -> bool {
+        self.cancelled.load(Ordering::Relaxed)
+    }
+
+    /// Fraction of work done (0 ~ 1). For `CalcEngine::Tree`, it is the fraction of
+    /// subtrees (tasks) that are done, which have the same amount of nodes if all
+    /// weights are different.
+    /// For `CalcEngine::Integral`, it is based on the maximum amount of integration
+    /// nodes, so it jumps to 1 once the result converges.
+    pub fn fraction(&self) -> f64 {
+        let total = self.tasks_total.load(Ordering::Relaxed);
+        if total == 0 {
+            return 0.;
+        }
+        self.tasks_done.load(Ordering::Relaxed) as f64 / total as f64
+    }
+
+    /// Amount of tree nodes (or integration nodes) visited. It is updated
+    /// by each worker after visiting tens of thousands of nodes.
+    #[inline(always)]
+    pub fn nodes_visited(&self) -> u64 {
+        self.nodes_visited.load(Ordering::Relaxed)
+    }
+
+    /// Time passed since the calculation is started.
+    pub fn elapsed(&self) -> Duration {
+        let time_start = *self.time_start.lock().unwrap();
+        time_start.map(|t| t.elapsed()).unwrap_or_default()
+    }
+
+    pub fn nodes_per_sec(&self) -> f64 {
+        self.nodes_visited() as f64 / self.elapsed().as_secs_f64().max(1e-9)
+    }
+
+    /// Estimated remaining time, which is `None` if nothing is done yet.
+    pub fn eta(&self) -> Option<Duration> {
+        let fraction = self.fraction();
+        if fraction <= 0. {
+            return None;
+        }
+        Some(self.elapsed().mul_f64((1. - fraction) / fraction))
+    }
+
+    /// Resets counters (but not the cancellation flag) for a new calculation.
+    fn start(&self) {
+        self.tasks_total.store(0, Ordering::Relaxed);
+        self.tasks_done.store(0, Ordering::Relaxed);
+        self.nodes_visited.store(0, Ordering::Relaxed);
+        *self.time_start.lock().unwrap() = Some(Instant::now());
+    }
+
+    #[inline(always)]
+    pub(crate) fn set_total(&self, tasks_total: usize) {
+        self.tasks_total.store(tasks_total, Ordering::Relaxed);
+    }
+
+    #[inline(always)]
+    pub(crate) fn add_done(&self, tasks: usize, nodes: u64) {
+        self.tasks_done.fetch_add(tasks, Ordering::Relaxed);
+        self.nodes_visited.fetch_add(nodes, Ordering::Relaxed);
+    }
+
+    /// Makes `fraction()` return 1 (used when the calculation ends early).
+    #[inline(always)]
+    pub(crate) fn finish(&self) {
+        let done = self.tasks_done.load(Ordering::Relaxed);
+        self.tasks_total.store(done, Ordering::Relaxed);
+    }
+}
+
+/// Multi-thread tree algorithm for the general non-repetitive case.
+/// `table_val` must be normalized (sum is 1).
+///
+/// Items of equal weights are equivalent, so they are grouped into classes, and
+/// the tree of picking sequences of classes is traversed instead: each node
+/// picks any remaining item of a class, and the probability of the class is
+/// divided by its size in the end. It has the same nodes as the tree of items
+/// if all weights are different, and orders of magnitude fewer nodes if there
+/// are a few distinct weights.
+fn calc_tree(
+    table_val: &[f64],
+    pick_amount: usize,
+    options: &CalcOptions,
+) -> Result<Vec<f64>, Error> {
+    let table_len = table_val.len();
+    let cnt_threads = options.cnt_threads();
+
+    // classes are indexed in the order of their first items
+    let mut class_of = Vec::with_capacity(table_len);
+    let (mut class_vals, mut class_sizes) = (Vec::new(), Vec::new());
+    let mut class_indexes = HashMap::new();
+    for &v in table_val {
+        let i_class = *class_indexes.entry(v.to_bits()).or_insert_with(|| {
+            class_vals.push(v);
+            class_sizes.push(0);
+            class_vals.len() - 1
+        });
+        class_sizes[i_class] += 1;
+        class_of.push(i_class);
+    }
+    let (table_val, cnt_classes) = (&class_vals[..], class_vals.len());
+
+    let split_depth = if options.split_depth > 0 {
+        options.split_depth.clamp(1, pick_amount - 1)
+    } else {
+        let (mut depth, mut cnt_tasks) = (1, cnt_classes);
+        while depth < pick_amount - 1 && cnt_tasks < cnt_threads * 16 {
+            depth += 1;
+            cnt_tasks = cnt_tasks.saturating_mul(cnt_classes.min(table_len + 1 - depth));
+        }
+        depth
+    };
+
+    // nodes above `split_depth` are calculated here, each node at `split_depth`
+    // becomes a task, `tasks` stores task prefixes of length `split_depth`.
+    let mut calc_result = vec![0.; cnt_classes];
+    let mut tasks = Vec::new();
+    let mut task_probs = Vec::new();
+    let mut prefix = Vec::with_capacity(split_depth);
+    let mut remaining = class_sizes.clone();
+    split_tasks(
+        table_val,
+        split_depth,
+        (&mut prefix, &mut remaining),
+        (1., 1.),
+        &mut calc_result,
+        (&mut tasks, &mut task_probs),
+    );
+
+    // a fixed amount of workers take tasks by increasing `next_task`; each worker
+    // shares `table_val` and adds probabilities of all its tasks into its own
+    // accumulator, so the memory usage is O(n * workers) instead of O(n) per task.
+    let cnt_tasks = task_probs.len();
+    let cnt_threads = cnt_threads.min(cnt_tasks);
+    let progress = options.progress.as_deref();
+    if let Some(progress) = progress {
+        progress.set_total(cnt_tasks);
+    }
+    let next_task = AtomicUsize::new(0);
+    let sub_results = thread::scope(|s| {
+        let thread_hdls: Vec<_> = (0..cnt_threads)
+            .map(|_| {
+                let (tasks, task_probs, next_task) = (&tasks, &task_probs, &next_task);
+                let class_sizes = &class_sizes[..];
+                s.spawn(move || {
+                    let next_task = || {
+                        let i_task = next_task.fetch_add(1, Ordering::Relaxed);
+                        let prefix = tasks.get(i_task * split_depth..(i_task + 1) * split_depth)?;
+                        Some((prefix, task_probs[i_task]))
+                    };
+                    match options.precision {
+                        CalcPrecision::Fast => {
+                            let calc_stack = CalcStack::<false>::new(
+                                table_val,
+                                class_sizes,
+                                pick_amount,
+                                split_depth,
+                            );
+                            calc_stack.run(next_task, progress)
+                        }
+                        CalcPrecision::Compensated => {
+                            let calc_stack = CalcStack::<true>::new(
+                                table_val,
+                                class_sizes,
+                                pick_amount,
+                                split_depth,
+                            );
+                            calc_stack.run(next_task, progress)
+                        }
+                    }
+                })
+            })
+            .collect();
+        thread_hdls
+            .into_iter()
+            .map(|hdl| hdl.join().map_err(|_| Error::ThreadError))
+            .collect::<Result<Vec<_>, _>>()
+    })?;
+    if progress.is_some_and(|p| p.is_cancelled()) {
+        return Err(Error::Cancelled);
+    }
+    merge_results(&mut calc_result, &sub_results);
+    Ok((class_of.into_iter())
+        .map(|i_class| calc_result[i_class] / class_sizes[i_class] as f64)
+        .collect())
+}
+
+/// Minimal amount of items in each chunk of `merge_results()`.
+const MERGE_CHUNK_LEN: usize = 1 << 14;
+
+/// Adds accumulators of workers into `result`. For large tables, chunks of
+/// indexes are summed up by different threads (each chunk is read from all
+/// accumulators), otherwise it's not worth spawning threads.
+fn merge_results(result: &mut [f64], sub_results: &[Vec<f64>]) {
+    let merge_chunk = |start: usize, chunk: &mut [f64]| {
+        for sub_result in sub_results {
+            let sub_chunk = &sub_result[start..start + chunk.len()];
+            for (v, &sub_v) in chunk.iter_mut().zip(sub_chunk) {
+                *v += sub_v;
             }
         }
+    };
+    if result.len() < 2 * MERGE_CHUNK_LEN || sub_results.len() < 2 {
+        merge_chunk(0, result);
+        return;
+    }
+    let chunk_len = result
+        .len()
+        .div_ceil(sub_results.len())
+        .max(MERGE_CHUNK_LEN);
+    thread::scope(|s| {
+        for (i, chunk) in result.chunks_mut(chunk_len).enumerate() {
+            s.spawn(move || merge_chunk(i * chunk_len, chunk));
+        }
+    });
+}
 
-        Ok(calc_result.into_iter().collect())
+/// Traverses the tree of classes until `depth`, adds probabilities of these nodes
+/// into `result`, and pushes nodes of `depth` into the task list. `remaining`
+/// stores the amount of unpicked items of each class.
+fn split_tasks(
+    table: &[f64],
+    depth: usize,
+    (prefix, remaining): (&mut Vec<usize>, &mut Vec<u32>),
+    (parent_prob, rem_width): (f64, f64),
+    result: &mut [f64],
+    (tasks, task_probs): (&mut Vec<usize>, &mut Vec<f64>),
+) {
+    if prefix.len() == depth {
+        tasks.extend_from_slice(prefix);
+        task_probs.push(parent_prob);
+        return;
+    }
+    for i in 0..table.len() {
+        if remaining[i] == 0 {
+            continue;
+        }
+        let prob = parent_prob * table[i] * remaining[i] as f64 / rem_width;
+        result[i] += prob;
+        prefix.push(i);
+        remaining[i] -= 1;
+        split_tasks(
+            table,
+            depth,
+            (prefix, remaining),
+            (prob, rem_width - table[i]),
+            result,
+            (tasks, task_probs),
+        );
+        remaining[i] += 1;
+        prefix.pop();
     }
 }
 
-#[derive(Clone, Debug)]
-struct CalcStack {
-    // Do not modify table and stack_size
-    table: Vec<f64>,   // size: table.len()
-    stack_size: usize, // = pick_amount - initial amount of picked items
+/// State of a worker, reused for all subtrees (tasks) taken by it. Indexes
+/// are of weight classes (see `calc_tree()`), and `result` stores the
+/// probability sum of each class. Probabilities are added by Kahan summation
+/// if `COMPENSATED` is true.
+#[derive(Clone, Debug, Default)]
+struct CalcStack<'a, const COMPENSATED: bool> {
+    // Do not modify table, class_sizes and stack_size
+    table: &'a [f64], // weight of each item of each class, shared by all workers
+    class_sizes: &'a [u32], // size: table.len()
+    stack_size: usize, // = pick_amount - length of task prefixes
 
     stack: Vec<(usize, f64)>, // maximum size: stack_size
-    table_picked: Vec<bool>,  // size: table.len()
+    remaining: Vec<u32>,      // size: table.len(), amount of unpicked items of each class
     rem_width: f64,           // current sum of grid cell widths of unpicked items
+    root_prob: f64,           // probability of the task prefix
+
+    // size: table.len(), the sum of results of all tasks, or partial sums
+    // since the last `flush()` if COMPENSATED
+    result: Vec<f64>,
 
-    result: Vec<f64>, // size: table.len()
+    // only used if COMPENSATED
+    sums: Vec<f64>,              // size: table.len(), Kahan sums of partial sums
+    compensation: Vec<f64>,      // size: table.len(), (negative) low-order parts of `sums`
+    cnt_unflushed: usize,        // amount of nodes added into `result` since the last flush
+    parent_rem_widths: Vec<f64>, // `rem_width` before each item in `stack` is picked
 }
 
-impl CalcStack {
+impl<'a, const COMPENSATED: bool> CalcStack<'a, COMPENSATED> {
     // Do not construct it by other means
-    // pick_amount includes items that were already picked
-    fn new(table: Vec<f64>, pick_amount: usize, table_picked: Vec<bool>) -> Self {
-        assert!(table.len() == table_picked.len());
-        let table_len = table.len();
-
-        let mut stack_size = pick_amount;
-        let mut rem_width = 0.;
-        for (i, &picked) in table_picked.iter().enumerate() {
-            if !picked {
-                rem_width += table[i];
-            } else {
-                if stack_size == 0 {
-                    break; // something is wrong
-                }
-                stack_size -= 1;
-            }
-        }
-
+    // pick_amount includes items of task prefixes of length `prefix_len`
+    fn new(
+        table: &'a [f64],
+        class_sizes: &'a [u32],
+        pick_amount: usize,
+        prefix_len: usize,
+    ) -> Self {
+        let table_len = class_sizes.iter().map(|&n| n as usize).sum::<usize>();
+        assert!(table.len() == class_sizes.len());
+        assert!(prefix_len < pick_amount && pick_amount <= table_len);
+        let stack_size = pick_amount - prefix_len;
         Self {
             table,
+            class_sizes,
             stack: Vec::with_capacity(stack_size),
             stack_size,
-            table_picked,
-            rem_width,
-            result: vec![0.; table_len],
+            remaining: class_sizes.to_vec(),
+            rem_width: 0.,
+            root_prob: 1.,
+            result: vec![0.; table.len()],
+            sums: vec![0.; if COMPENSATED { table.len() } else { 0 }],
+            compensation: vec![0.; if COMPENSATED { table.len() } else { 0 }],
+            cnt_unflushed: 0,
+            parent_rem_widths: Vec::with_capacity(if COMPENSATED { stack_size } else { 0 }),
+        }
+    }
+
+    /// Calculates tasks returned by `next_task` until it returns `None` or the
+    /// calculation is cancelled, and returns the sum of their results.
+    fn run<'t>(
+        mut self,
+        mut next_task: impl FnMut() -> Option<(&'t [usize], f64)>,
+        progress: Option<&CalcProgress>,
+    ) -> Vec<f64> {
+        while let Some((prefix, prefix_prob)) = next_task() {
+            if progress.is_some_and(|p| p.is_cancelled())
+                || !self.calc(prefix, prefix_prob, progress)
+            {
+                break;
+            }
+        }
+        if !COMPENSATED {
+            return self.result;
+        }
+        self.flush();
+        for (v, c) in self.sums.iter_mut().zip(&self.compensation) {
+            *v -= c;
         }
+        self.sums
     }
 
-    fn calc(mut self) -> Vec<f64> {
+    /// Adds partial sums in `result` into `sums` by Kahan summation, and clears them.
+    /// Each node adds one floating-point number into `result`, and Kahan summation
+    /// for each node would make the traversal about 2x slower; with this done every
+    /// `FLUSH_NODES_PER_ITEM * table.len()` nodes, it costs a few percent, and each
+    /// partial sum consists of no more than a few dozen numbers (on average).
+    fn flush(&mut self) {
+        for (i, partial) in self.result.iter_mut().enumerate() {
+            let y = *partial - self.compensation[i];
+            let t = self.sums[i] + y;
+            self.compensation[i] = (t - self.sums[i]) - y;
+            self.sums[i] = t;
+            *partial = 0.;
+        }
+        self.cnt_unflushed = 0;
+    }
+
+    /// Visits all nodes of the subtree under `prefix`, whose probability is
+    /// `prefix_prob`, and adds their probabilities into `result`. If `progress`
+    /// is given, it is updated after visiting every `NODES_PER_REPORT` nodes,
+    /// and `false` is returned if it is cancelled.
+    fn calc(
+        &mut self,
+        prefix: &[usize],
+        prefix_prob: f64,
+        progress: Option<&CalcProgress>,
+    ) -> bool {
+        for &i in prefix {
+            self.remaining[i] -= 1;
+        }
+        self.rem_width = (self.table.iter().zip(&self.remaining))
+            .filter(|(_, &n)| n > 0)
+            .map(|(v, &n)| v * n as f64)
+            .sum();
+        self.root_prob = prefix_prob;
+        self.stack.clear();
+        self.parent_rem_widths.clear();
+
+        // the traversal is much faster on a local value than behind `&mut self`
+        let mut this = std::mem::take(self);
+        let mut cnt_nodes = 0;
+        let mut cancelled = false;
         loop {
-            if self.go_down() {
-                continue;
+            if !(this.go_down() || this.go_right() || this.go_up_right()) {
+                break;
             }
-            if self.go_right() {
-                continue;
+            cnt_nodes += 1;
+            if COMPENSATED {
+                this.cnt_unflushed += 1;
+                if this.cnt_unflushed == FLUSH_NODES_PER_ITEM * this.table.len() {
+                    this.flush();
+                }
             }
-            if self.go_up_right() {
-                continue;
+            if cnt_nodes == NODES_PER_REPORT {
+                if let Some(progress) = progress {
+                    progress.add_done(0, cnt_nodes);
+                    if progress.is_cancelled() {
+                        cancelled = true;
+                        break;
+                    }
+                }
+                cnt_nodes = 0;
             }
-            return self.result;
         }
+        *self = this;
+        self.remaining.copy_from_slice(self.class_sizes);
+        if cancelled {
+            return false;
+        }
+        if let Some(progress) = progress {
+            progress.add_done(1, cnt_nodes);
+        }
+        true
     }
 
     #[inline(always)]
@@ -170,11 +704,15 @@ impl CalcStack {
             return false;
         };
 
-        let parent_prob = self.stack.last().map(|t| t.1).unwrap_or(1.);
-        let prob = parent_prob * self.table[i_next] / self.rem_width;
+        let parent_prob = self.stack.last().map(|t| t.1).unwrap_or(self.root_prob);
+        let class_width = self.table[i_next] * self.remaining[i_next] as f64;
+        let prob = parent_prob * class_width / self.rem_width;
 
         self.stack.push((i_next, prob));
-        self.table_picked[i_next] = true;
+        if COMPENSATED {
+            self.parent_rem_widths.push(self.rem_width);
+        }
+        self.remaining[i_next] -= 1;
         self.rem_width -= self.table[i_next];
         self.result[i_next] += prob;
         true
@@ -200,14 +738,21 @@ impl CalcStack {
         let parent_prob = if stack_level >= 2 {
             self.stack[stack_level - 2].1
         } else {
-            1.
+            self.root_prob
+        };
+        // in compensated mode, `rem_width` is restored exactly instead of drifting
+        // with rounding errors of millions of additions and subtractions
+        let parent_rem_width = if COMPENSATED {
+            self.parent_rem_widths[stack_level - 1]
+        } else {
+            self.rem_width + self.table[i_prev]
         };
-        let parent_rem_width = self.rem_width + self.table[i_prev];
-        let prob = parent_prob * self.table[i_next] / parent_rem_width;
+        let class_width = self.table[i_next] * self.remaining[i_next] as f64;
+        let prob = parent_prob * class_width / parent_rem_width;
 
         *self.stack.last_mut().unwrap() = (i_next, prob);
-        self.table_picked[i_prev] = false;
-        self.table_picked[i_next] = true;
+        self.remaining[i_prev] += 1;
+        self.remaining[i_next] -= 1;
         self.rem_width = parent_rem_width - self.table[i_next];
         self.result[i_next] += prob;
         true
@@ -215,8 +760,12 @@ impl CalcStack {
 
     fn go_up_right(&mut self) -> bool {
         while let Some((i_prev, _)) = self.stack.pop() {
-            self.table_picked[i_prev] = false;
-            self.rem_width += self.table[i_prev];
+            self.remaining[i_prev] += 1;
+            if COMPENSATED {
+                self.rem_width = self.parent_rem_widths.pop().unwrap();
+            } else {
+                self.rem_width += self.table[i_prev];
+            }
             if self.go_right() {
                 return true;
             }
@@ -225,11 +774,11 @@ impl CalcStack {
     }
 
     fn next_unpicked(&self, least_index: usize) -> Option<usize> {
-        self.table_picked
+        self.remaining
             .iter()
             .enumerate()
             .skip(least_index)
-            .find(|(_, &picked)| !picked)
+            .find(|(_, &n)| n > 0)
             .map(|(i, _)| i)
     }
 }
@@ -98,9 +98,9 @@ impl<T: Clone + Eq + Hash> Config<T> {
         self.check()?;
         let vec = if !self.inversed {
             self.table
-                .clone()
-                .into_iter()
-                .filter(|&(_, v)| v > 0.)
+                .iter()
+                .filter(|&(_, &v)| v > 0.)
+                .map(|(k, &v)| (k.clone(), v))
                 .collect()
         } else {
             self.table
@@ -110,6 +110,18 @@ impl<T: Clone + Eq + Hash> Config<T> {
         };
         Ok(vec)
     }
+
+    /// Does the same thing as `vec_table()`, but moves items instead of cloning them.
+    #[inline]
+    pub(crate) fn into_vec_table(self) -> Result<Vec<(T, f64)>, Error> {
+        self.check()?;
+        let vec = if !self.inversed {
+            self.table.into_iter().filter(|&(_, v)| v > 0.).collect()
+        } else {
+            self.table.into_iter().map(|(k, v)| (k, 1. / v)).collect()
+        };
+        Ok(vec)
+    }
 }
 
 impl<T: Clone + Eq + Hash> Default for Config<T> {
@@ -163,41 +175,71 @@ impl Config<String> {
     /// ```
     pub fn append_str(&mut self, str_items: &str) {
         for line in str_items.split(&['\r', '\n', ';']) {
-            let mut spl = line.split(&[' ', '\t', '=']).filter(|s| !s.is_empty());
-            let item_name;
-            if let Some(s) = spl.next() {
-                if let Some('#') = s.chars().nth(0) {
-                    continue;
-                }
-                item_name = s;
-            } else {
-                continue;
+            if let Some(line) = ConfLine::parse(line) {
+                self.apply_line(line);
             }
+        }
+    }
 
-            // compatible with the old table format
-            if item_name == "power_inversed" {
-                self.inversed = true;
-            } else if item_name == "repetitive_picking" {
-                self.repetitive = true;
-            } else if let Some(s) = spl.last() {
-                if item_name == "delete" {
-                    let _ = self.table.remove(s);
-                } else if item_name == "inversed" {
-                    if let Ok(b) = bool::from_str(s) {
-                        self.inversed = b;
-                    }
-                } else if item_name == "repetitive" {
-                    if let Ok(b) = bool::from_str(s) {
-                        self.repetitive = b;
-                    }
-                } else if let Ok(v) = f64::from_str(s) {
-                    self.table.insert(item_name.to_string(), v);
-                }
+    #[inline]
+    pub(crate) fn apply_line(&mut self, line: ConfLine<'_>) {
+        match line {
+            ConfLine::Inversed(b) => self.inversed = b,
+            ConfLine::Repetitive(b) => self.repetitive = b,
+            ConfLine::Delete(item_name) => {
+                let _ = self.table.remove(item_name);
+            }
+            ConfLine::Item(item_name, v) => {
+                self.table.insert(item_name.to_string(), v);
             }
         }
     }
 }
 
+/// Meaningful content of a line in the configuration input.
+pub(crate) enum ConfLine<'a> {
+    Inversed(bool),
+    Repetitive(bool),
+    Delete(&'a str),
+    Item(&'a str, f64),
+}
+
+impl<'a> ConfLine<'a> {
+    /// Parses a line which doesn't contain line breaks or `;`. Returns `None`
+    /// for empty lines, comments and invalid lines.
+    pub(crate) fn parse(line: &'a str) -> Option<Self> {
+        // only the first and the last word are used; separators are ASCII bytes,
+        // so that the line is searched byte by byte without decoding chars.
+        let is_sep = |b: &u8| matches!(b, b' ' | b'\t' | b'=');
+        let bytes = line.as_bytes();
+        let start = bytes.iter().position(|b| !is_sep(b))?;
+        let end = (bytes[start..].iter().position(is_sep)).map_or(bytes.len(), |i| start + i);
+        let item_name = &line[start..end];
+        if item_name.starts_with('#') {
+            return None;
+        }
+
+        // compatible with the old table format
+        if item_name == "power_inversed" {
+            return Some(Self::Inversed(true));
+        } else if item_name == "repetitive_picking" {
+            return Some(Self::Repetitive(true));
+        }
+        let last_end = bytes.iter().rposition(|b| !is_sep(b))? + 1;
+        if last_end <= end {
+            return None; // there is only one word
+        }
+        let last_start = (bytes[..last_end].iter().rposition(is_sep)).map_or(0, |i| i + 1);
+        let s = &line[last_start..last_end];
+        match item_name {
+            "delete" => Some(Self::Delete(s)),
+            "inversed" => bool::from_str(s).ok().map(Self::Inversed),
+            "repetitive" => bool::from_str(s).ok().map(Self::Repetitive),
+            _ => f64::from_str(s).ok().map(|v| Self::Item(item_name, v)),
+        }
+    }
+}
+
 impl FromStr for Config<String> {
     type Err = Error;
     #[inline(always)]
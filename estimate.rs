@@ -0,0 +1,269 @@
+use crate::{rngs::Xoshiro256PlusPlus, *};
+use rand::{rngs::OsRng, SeedableRng};
+use std::{
+    hash::Hash,
+    sync::{
+        atomic::{AtomicBool, Ordering},
+        mpsc, Arc,
+    },
+    thread,
+    time::{Duration, Instant},
+};
+
+/// Amount of picking results in each batch of a worker.
+const BATCH_SIZE: usize = 4096;
+/// Amount of results generated by a worker between two checks of the stop flag.
+const STOP_CHECK_INTERVAL: usize = 256;
+/// Standard errors are not trusted before this amount of batches are done.
+const MIN_BATCHES: usize = 16;
+/// Used when neither `time_limit` nor `target_half_width` is given.
+const DEFAULT_TIME_LIMIT: Duration = Duration::from_secs(1);
+/// Used when `target_half_width` is given without `time_limit`, in case
+/// the target is too small to be reached in practice.
+const MAX_TIME_LIMIT: Duration = Duration::from_secs(60);
+/// Quantile of the standard normal distribution for 95% confidence intervals.
+const Z_95: f64 = 1.959964;
+
+/// Options for `Config::estimate_probabilities()`. Please construct it with
+/// `..Default::default()`, because new options may be added in the future.
+#[derive(Clone, Debug, Default)]
+pub struct EstimateOptions {
+    /// Amount of worker threads. 0 means `std::thread::available_parallelism()`.
+    pub threads: usize,
+    /// Stops after this duration (the last batch of each worker may exceed it slightly).
+    pub time_limit: Option<Duration>,
+    /// Stops once the half width of the 95% confidence interval of every item
+    /// is not greater than this value, for example, 0.001 for ±0.1%. It must be
+    /// positive and finite, otherwise `Error::InvalidOptions` is returned.
+    /// If `time_limit` is not given, it still stops after 60 seconds (check
+    /// `Estimate::target_met`); if neither is given, it runs for 1 second.
+    pub target_half_width: Option<f64>,
+    /// Seed of random sources for reproducible results (with 1 thread);
+    /// the OS random source is used for seeding if it is `None`.
+    pub seed: Option<u64>,
+}
+
+/// Result of `Config::estimate_probabilities()`.
+#[derive(Clone, Debug)]
+pub struct Estimate<T> {
+    /// Estimated probabilities of items being picked up.
+    pub probs: Table<T>,
+    /// Standard errors of `probs` (multiply them by 1.96 for 95% confidence intervals).
+    pub std_errors: Table<T>,
+    /// Amount of picking results being generated (0 if the result is exact).
+    pub samples: usize,
+    /// Whether `target_half_width` is reached (always true if the result is exact).
+    pub target_met: bool,
+}
+
+impl<T: Clone + Eq + Hash + Send + Sync> Config<T> {
+    /// Estimates probabilities that `calc_probabilities()` returns, by parallel
+    /// Monte-Carlo simulation with a time budget or a target confidence interval.
+    /// Cases in which `calc_probabilities()` costs O(n) are calculated exactly.
+    ///
+    /// Stratification on the first pick is applied: in each batch of `BATCH_SIZE`
+    /// results, first picks are chosen by systematic sampling of the cumulative
+    /// weights (so that each item is picked first in proportion to its weight),
+    /// then the rest items are picked randomly. Standard errors are calculated from
+    /// the variance of batch means.
+    ///
+    /// ```
+    /// use random_picker::{Config, EstimateOptions};
+    /// let conf: Config<String> = "a=1;b=2;c=3;d=4;e=5;f=6;g=7;h=8".parse().unwrap();
+    /// let probs = conf.calc_probabilities(3).unwrap();
+    /// let options = EstimateOptions {
+    ///     target_half_width: Some(0.002),
+    ///     ..Default::default()
+    /// };
+    /// let est = conf.estimate_probabilities(3, &options).unwrap();
+    /// assert!(est.target_met);
+    /// for (k, v) in probs.iter() {
+    ///     assert!((est.probs[k] - v).abs() < 5. * est.std_errors[k] + 1e-9);
+    ///     assert!(1.96 * est.std_errors[k] <= 0.002);
+    /// }
+    ///
+    /// // only 2 items of nonzero weights: calculated exactly
+    /// let conf: Config<String> = "a=1;b=2;c=0;d=0".parse().unwrap();
+    /// let est = conf.estimate_probabilities(3, &options).unwrap();
+    /// assert_eq!((est.probs["a"], est.probs["b"], est.samples), (1., 1., 0));
+    ///
+    /// let options = EstimateOptions {
+    ///     target_half_width: Some(0.),
+    ///     ..Default::default()
+    /// };
+    /// let result = conf.estimate_probabilities(3, &options);
+    /// assert!(matches!(result, Err(random_picker::Error::InvalidOptions)));
+    /// ```
+    pub fn estimate_probabilities(
+        &self,
+        pick_amount: usize,
+        options: &EstimateOptions,
+    ) -> Result<Estimate<T>, Error> {
+        if let Some(half_width) = options.target_half_width {
+            if !(half_width.is_finite() && half_width > 0.) {
+                return Err(Error::InvalidOptions);
+            }
+        }
+        let exact = || -> Result<Estimate<T>, Error> {
+            let probs = self.calc_probabilities(pick_amount)?;
+            let std_errors = probs.keys().map(|k| (k.clone(), 0.)).collect();
+            Ok(Estimate {
+                probs,
+                std_errors,
+                samples: 0,
+                target_met: true,
+            })
+        };
+        if self.repetitive || pick_amount <= 1 || self.is_fair() {
+            return exact();
+        }
+
+        // items of zero weights are dropped by the compiled table
+        let table = Arc::new(CompiledTable::build(self.clone())?);
+        let table_len = table.len();
+        if pick_amount >= table_len {
+            return exact();
+        }
+        let cum_weights: Vec<f64> = (table.weights().iter())
+            .scan(0., |acc, &w| {
+                *acc += w;
+                Some(*acc)
+            })
+            .collect();
+
+        let cnt_threads = if options.threads > 0 {
+            options.threads
+        } else {
+            thread::available_parallelism()
+                .map(|n| n.get())
+                .unwrap_or(4)
+        };
+        let time_limit = match (options.time_limit, options.target_half_width) {
+            (Some(t), _) => t,
+            (None, None) => DEFAULT_TIME_LIMIT,
+            (None, Some(_)) => MAX_TIME_LIMIT,
+        };
+        let mut rng = match options.seed {
+            Some(seed) => Xoshiro256PlusPlus::seed_from_u64(seed),
+            None => Xoshiro256PlusPlus::from_rng(OsRng).map_err(Error::RandError)?,
+        };
+
+        // sums of batch means and of their squares
+        let mut sums = vec![0.; table_len];
+        let mut sums_sq = vec![0.; table_len];
+        let mut cnt_batches = 0;
+        let mut target_met = false;
+
+        let t_start = Instant::now();
+        let stop = AtomicBool::new(false);
+        let (tx, rx) = mpsc::channel();
+        thread::scope(|s| {
+            let mut thread_hdls = Vec::with_capacity(cnt_threads);
+            for _ in 0..cnt_threads {
+                let mut picker = Picker::from_table(table.clone(), rng.split());
+                let (cum_weights, stop, tx) = (&cum_weights, &stop, tx.clone());
+                thread_hdls.push(s.spawn(move || -> Result<(), Error> {
+                    let mut counts = vec![0u32; table_len];
+                    while !stop.load(Ordering::Relaxed) {
+                        if !run_batch(&mut picker, cum_weights, pick_amount, &mut counts, stop)? {
+                            break;
+                        }
+                        if tx.send(counts.clone()).is_err() {
+                            break;
+                        }
+                        counts.fill(0);
+                    }
+                    Ok(())
+                }));
+            }
+            drop(tx);
+
+            for counts in rx.iter() {
+                for ((sum, sum_sq), &c) in sums.iter_mut().zip(sums_sq.iter_mut()).zip(&counts) {
+                    let mean = c as f64 / BATCH_SIZE as f64;
+                    *sum += mean;
+                    *sum_sq += mean * mean;
+                }
+                cnt_batches += 1;
+
+                if let Some(half_width) = options.target_half_width {
+                    if cnt_batches >= MIN_BATCHES && cnt_batches % cnt_threads == 0 {
+                        let max_err = (sums.iter().zip(&sums_sq))
+                            .map(|(&s, &s_sq)| std_error(s, s_sq, cnt_batches))
+                            .fold(0., f64::max);
+                        target_met = Z_95 * max_err <= half_width;
+                    }
+                }
+                let timeout = t_start.elapsed() >= time_limit;
+                if target_met || timeout {
+                    stop.store(true, Ordering::Relaxed);
+                    break; // results of the last batches are dropped
+                }
+            }
+            drop(rx);
+            for hdl in thread_hdls {
+                hdl.join().map_err(|_| Error::ThreadError)??;
+            }
+            Ok(())
+        })?;
+
+        let cnt = cnt_batches.max(1);
+        let mut probs = Table::with_capacity(table_len);
+        let mut std_errors = Table::with_capacity(table_len);
+        for (i, key) in table.keys().iter().enumerate() {
+            probs.insert(key.clone(), sums[i] / cnt as f64);
+            std_errors.insert(key.clone(), std_error(sums[i], sums_sq[i], cnt));
+        }
+        Ok(Estimate {
+            probs,
+            std_errors,
+            samples: cnt_batches * BATCH_SIZE,
+            target_met,
+        })
+    }
+}
+
+/// Generates `BATCH_SIZE` results stratified on the first pick,
+/// and adds the count of each item into `counts`. Returns `false` if
+/// `stop` is set before the batch is completed.
+fn run_batch<T, R>(
+    picker: &mut Picker<T, R>,
+    cum_weights: &[f64],
+    pick_amount: usize,
+    counts: &mut [u32],
+    stop: &AtomicBool,
+) -> Result<bool, Error>
+where
+    T: Clone + Eq + Hash,
+    R: rand::RngCore,
+{
+    let total = cum_weights[cum_weights.len() - 1];
+    let offset = (rand::RngCore::next_u64(picker.rng_mut()) >> 11) as f64 / (1u64 << 53) as f64;
+    let mut first = 0;
+    for b in 0..BATCH_SIZE {
+        if b % STOP_CHECK_INTERVAL == 0 && stop.load(Ordering::Relaxed) {
+            return Ok(false);
+        }
+        // ascending values, so that the first pick can be found by a linear walk
+        let val = (b as f64 + offset) / BATCH_SIZE as f64 * total;
+        while first < cum_weights.len() - 1 && cum_weights[first] <= val {
+            first += 1;
+        }
+        picker.pick_indexes_after(&[first], pick_amount)?;
+        for &i in picker.picked_indexes() {
+            counts[i] += 1;
+        }
+    }
+    Ok(true)
+}
+
+/// Standard error of the mean of `cnt` batch means.
+#[inline(always)]
+fn std_error(sum: f64, sum_sq: f64, cnt: usize) -> f64 {
+    if cnt < 2 {
+        return f64::INFINITY;
+    }
+    let cnt = cnt as f64;
+    let var = ((sum_sq - sum * sum / cnt) / (cnt - 1.)).max(0.);
+    (var / cnt).sqrt()
+}
@@ -0,0 +1,188 @@
+use crate::*;
+use std::thread;
+
+// t = exp(s) is integrated over s, within the range where the integrand is not negligible.
+const T_LOW: f64 = 1e-18; // multiplied by 1 / (largest weight)
+const T_HIGH: f64 = 45.; // multiplied by 1 / (smallest weight), exp(-45) < 1e-19
+const INITIAL_STEP: f64 = 0.5;
+const MAX_LEVELS: usize = 12;
+const TOLERANCE: f64 = 1e-13;
+
+/// Calculates probabilities for the general non-repetitive case by numeric
+/// integration of the exponential-clock formulation: picking without replacement
+/// is equivalent to ordering items by `E_i / w_i` in which `E_i` are independent
+/// standard exponential variables, so item `i` is picked if less than `pick_amount`
+/// of other items have their clocks ringing before `T_i = E_i / w_i`:
+///
+/// `p_i = integral of w_i * exp(-w_i * t) * P(less than pick_amount of T_j < t, j != i) dt`.
+///
+/// The trapezoidal rule is applied with `t = exp(s)`, and the step is halved until
+/// results are stable. Each node costs O(n * pick_amount).
+/// `table_val` must be normalized (sum is 1).
+pub(crate) fn calc_integral(
+    table_val: &[f64],
+    pick_amount: usize,
+    cnt_threads: usize,
+    progress: Option<&CalcProgress>,
+) -> Result<Vec<f64>, Error> {
+    let w_max = table_val.iter().copied().fold(0., f64::max);
+    let w_min = table_val.iter().copied().fold(f64::INFINITY, f64::min);
+    let s_low = (T_LOW / w_max).ln();
+    let s_high = (T_HIGH / w_min).ln();
+
+    // level 0: nodes at s_low + j * step (j = 0..=cnt); next levels: midpoints
+    let mut step = INITIAL_STEP;
+    let cnt = ((s_high - s_low) / step).ceil() as usize;
+    let nodes: Vec<f64> = (0..=cnt).map(|j| s_low + j as f64 * step).collect();
+    if let Some(progress) = progress {
+        progress.set_total((cnt << MAX_LEVELS) + 1); // nodes of all levels
+    }
+    let mut sums = eval_nodes(table_val, pick_amount, &nodes, cnt_threads, progress)?;
+    let mut result: Vec<f64> = sums.iter().map(|v| v * step).collect();
+
+    let mut cnt_intervals = cnt;
+    for _ in 0..MAX_LEVELS {
+        let nodes: Vec<f64> = (0..cnt_intervals)
+            .map(|j| s_low + (j as f64 + 0.5) * step)
+            .collect();
+        let mid_sums = eval_nodes(table_val, pick_amount, &nodes, cnt_threads, progress)?;
+        step /= 2.;
+        cnt_intervals *= 2;
+
+        let mut max_diff: f64 = 0.;
+        for ((r, s), m) in result.iter_mut().zip(sums.iter_mut()).zip(mid_sums) {
+            *s += m;
+            let r_new = *s * step;
+            max_diff = max_diff.max((r_new - *r).abs());
+            *r = r_new;
+        }
+        if max_diff < TOLERANCE {
+            break;
+        }
+    }
+    if let Some(progress) = progress {
+        progress.finish();
+    }
+    Ok(result)
+}
+
+/// Returns the sum of integrand values over `nodes` (values of s) for each item.
+fn eval_nodes(
+    table: &[f64],
+    pick_amount: usize,
+    nodes: &[f64],
+    cnt_threads: usize,
+    progress: Option<&CalcProgress>,
+) -> Result<Vec<f64>, Error> {
+    let chunk_size = nodes.len().div_ceil(cnt_threads.max(1)).max(1);
+    thread::scope(|s| {
+        let thread_hdls: Vec<_> = nodes
+            .chunks(chunk_size)
+            .map(|chunk| {
+                s.spawn(move || {
+                    let mut integrator = Integrator::new(table, pick_amount);
+                    for &s in chunk {
+                        if let Some(progress) = progress {
+                            if progress.is_cancelled() {
+                                break;
+                            }
+                            progress.add_done(1, 1);
+                        }
+                        integrator.add_node(s.exp());
+                    }
+                    integrator.sums
+                })
+            })
+            .collect();
+        let mut sums = vec![0.; table.len()];
+        for hdl in thread_hdls {
+            let sub_sums = hdl.join().map_err(|_| Error::ThreadError)?;
+            for (v, sub) in sums.iter_mut().zip(sub_sums) {
+                *v += sub;
+            }
+        }
+        match progress {
+            Some(progress) if progress.is_cancelled() => Err(Error::Cancelled),
+            _ => Ok(sums),
+        }
+    })
+}
+
+struct Integrator<'a> {
+    table: &'a [f64],
+    k: usize, // pick_amount
+
+    // prefix[i * k + m]: probability that m of items before i have rung (m < k)
+    prefix: Vec<f64>,
+    suffix: Vec<f64>, // same as above, for items after the current item
+    cum_suffix: Vec<f64>,
+    q: Vec<f64>, // probabilities of having rung before t
+
+    sums: Vec<f64>,
+}
+
+impl<'a> Integrator<'a> {
+    fn new(table: &'a [f64], pick_amount: usize) -> Self {
+        let n = table.len();
+        Self {
+            table,
+            k: pick_amount,
+            prefix: vec![0.; n * pick_amount],
+            suffix: vec![0.; pick_amount],
+            cum_suffix: vec![0.; pick_amount],
+            q: vec![0.; n],
+            sums: vec![0.; n],
+        }
+    }
+
+    fn add_node(&mut self, t: f64) {
+        let (n, k) = (self.table.len(), self.k);
+        for (q, &w) in self.q.iter_mut().zip(self.table) {
+            *q = -(-w * t).exp_m1();
+        }
+
+        self.prefix[..k].fill(0.);
+        self.prefix[0] = 1.;
+        for i in 1..n {
+            let (prev, cur) = self.prefix[(i - 1) * k..(i + 1) * k].split_at_mut(k);
+            convolve(prev, self.q[i - 1], cur);
+        }
+
+        self.suffix.fill(0.);
+        self.suffix[0] = 1.;
+        for i in (0..n).rev() {
+            let cum_suffix = &mut self.cum_suffix;
+            let mut acc = 0.;
+            for (c, &v) in cum_suffix.iter_mut().zip(&self.suffix) {
+                acc += v;
+                *c = acc;
+            }
+            // P(less than k of other items have rung)
+            let prefix = &self.prefix[i * k..(i + 1) * k];
+            let p_others: f64 = (0..k).map(|a| prefix[a] * cum_suffix[k - 1 - a]).sum();
+
+            let wt = self.table[i] * t;
+            self.sums[i] += wt * (-wt).exp() * p_others;
+
+            convolve_in_place(&mut self.suffix, self.q[i]);
+        }
+    }
+}
+
+/// `dest = src * ((1 - q) + q x)`, truncated to the length of `src`.
+#[inline(always)]
+fn convolve(src: &[f64], q: f64, dest: &mut [f64]) {
+    dest[0] = src[0] * (1. - q);
+    for m in 1..src.len() {
+        dest[m] = src[m] * (1. - q) + src[m - 1] * q;
+    }
+}
+
+/// Does the same as `convolve()` with `src` and `dest` being the same.
+#[inline(always)]
+fn convolve_in_place(v: &mut [f64], q: f64) {
+    for m in (1..v.len()).rev() {
+        v[m] = v[m] * (1. - q) + v[m - 1] * q;
+    }
+    v[0] *= 1. - q;
+}
@@ -5,11 +5,40 @@
 
 // by wuwbobo2021 <https://github.com/wuwbobo2021>, <wuwbobo@outlook.com>
 
+mod alias;
+#[cfg(feature = "batch")]
+mod batch;
+mod bits;
+mod cache;
 mod calc;
 mod config;
+mod estimate;
+mod integral;
+mod loader;
 mod picker;
+pub mod rngs;
+mod search;
+mod shared;
+mod stats;
+mod table;
+mod table_file;
+mod tree;
 
-pub use crate::{config::*, picker::*};
+pub use crate::{
+    cache::ProbCache,
+    calc::{CalcEngine, CalcOptions, CalcPrecision, CalcProgress},
+    config::*,
+    estimate::{Estimate, EstimateOptions},
+    picker::*,
+    shared::{SharedPicker, SharedTable},
+    table::CompiledTable,
+    table_file::TableFile,
+};
+
+#[cfg(feature = "batch")]
+pub use crate::batch::BatchOptions;
+#[cfg(feature = "stats")]
+pub use crate::stats::PickerStats;
 
 /// Convenience wrapper for exactly one picking operation.
 ///
@@ -28,7 +57,9 @@ where
 }
 
 /// Possible errors returned by functions in this crate.
+/// New variants may be added in the future, so `match` needs a wildcard arm.
 #[derive(Debug)]
+#[non_exhaustive]
 pub enum Error {
     /// The table is invalid and cannot be used by the picker.
     InvalidTable,
@@ -38,6 +69,13 @@ pub enum Error {
     RandError(rand::Error),
     /// Failure of the multi-thread probability calculator.
     ThreadError,
+    /// The calculation is cancelled by `CalcProgress::cancel()`.
+    Cancelled,
+    /// Error from reading the table (including invalid UTF-8 input).
+    IoError(std::io::Error),
+    /// The given options are invalid, for example, a target confidence
+    /// interval that is not positive.
+    InvalidOptions,
 }
 
 impl std::fmt::Display for Error {
@@ -48,6 +86,9 @@ impl std::fmt::Display for Error {
             InvalidAmount => write!(f, "Invalid amount of items to be picked up"),
             RandError(e) => write!(f, "RNG Error: {:?}", e),
             ThreadError => write!(f, "Thread error during calculation"),
+            Cancelled => write!(f, "Calculation cancelled"),
+            IoError(e) => write!(f, "IO Error: {e}"),
+            InvalidOptions => write!(f, "Invalid options"),
         }
     }
 }
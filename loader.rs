@@ -0,0 +1,118 @@
+use crate::{config::ConfLine, *};
+use std::{
+    hash::{DefaultHasher, Hash, Hasher},
+    io::{self, BufRead},
+};
+
+impl Config<String> {
+    /// Does the same thing as `append_str()` with the input read from `reader`
+    /// line by line, so that the whole input is never kept in memory.
+    ///
+    /// ```
+    /// let input = "repetitive = true\na = 1; b = 2\nc 3\ndelete b\n";
+    /// let mut conf = random_picker::Config::new();
+    /// conf.append_from(input.as_bytes()).unwrap();
+    /// assert_eq!(conf, input.parse().unwrap());
+    /// ```
+    pub fn append_from<R: BufRead>(&mut self, reader: R) -> Result<(), Error> {
+        for_each_line(reader, |line| self.apply_line(line))
+    }
+}
+
+impl CompiledTable<String> {
+    /// Reads the input in the format of `Config::append_str()` from `reader`,
+    /// and compiles it without building the `HashMap` of `Config`. It is meant
+    /// for loading large table files: lines are parsed in a reused buffer, and
+    /// the item name is the only allocation of each line.
+    ///
+    /// The last line of each name takes effect (a `delete` line removes preceding
+    /// lines of the name) as `append_str()` does, and items are indexed in the
+    /// order of their effective lines.
+    ///
+    /// ```
+    /// use random_picker::CompiledTable;
+    /// let input = "b = 2; a = 1; c = 3; d = 0\na = 4\ndelete c\n";
+    /// let table = CompiledTable::read_from(input.as_bytes()).unwrap();
+    /// assert_eq!(table.keys(), ["b", "a"]);
+    /// assert_eq!(table.weights(), [2., 4.]);
+    /// assert!(CompiledTable::read_from("delete a".as_bytes()).is_err());
+    /// ```
+    pub fn read_from<R: BufRead>(reader: R) -> Result<Self, Error> {
+        let (mut inversed, mut repetitive) = (false, false);
+        let mut items: Vec<(String, Option<f64>)> = Vec::new(); // `None` for `delete`
+        for_each_line(reader, |line| match line {
+            ConfLine::Inversed(b) => inversed = b,
+            ConfLine::Repetitive(b) => repetitive = b,
+            ConfLine::Delete(item_name) => items.push((item_name.to_string(), None)),
+            ConfLine::Item(item_name, v) => items.push((item_name.to_string(), Some(v))),
+        })?;
+
+        // find lines of the same name by sorting hashes of names instead of names,
+        // which is much faster for millions of items; item order is kept.
+        let mut order: Vec<(u64, usize)> = (items.iter().enumerate())
+            .map(|(i, (k, _))| (hash_name(k), i))
+            .collect();
+        order.sort_unstable();
+        let mut overridden = vec![false; items.len()];
+        for run in order.chunk_by_mut(|a, b| a.0 == b.0) {
+            if run.len() > 1 {
+                // the sort is stable, so the last line of each name is at its end
+                run.sort_by(|&(_, a), &(_, b)| items[a].0.cmp(&items[b].0));
+                for pair in run.windows(2) {
+                    overridden[pair[0].1] = items[pair[0].1].0 == items[pair[1].1].0;
+                }
+            }
+        }
+
+        let mut keys = Vec::with_capacity(items.len());
+        let mut weights = Vec::with_capacity(items.len());
+        for ((k, v), overridden) in items.into_iter().zip(overridden) {
+            if overridden {
+                continue;
+            }
+            let Some(v) = v else {
+                continue;
+            };
+            // the same as `Config::check()` and `Config::into_vec_table()`
+            if v < 0. || (inversed && v == 0.) {
+                return Err(Error::InvalidTable);
+            }
+            if inversed {
+                keys.push(k);
+                weights.push(1. / v);
+            } else if v > 0. {
+                keys.push(k);
+                weights.push(v);
+            }
+        }
+        if keys.is_empty() {
+            return Err(Error::InvalidTable);
+        }
+        Ok(Self::from_parts(keys, weights, inversed, repetitive))
+    }
+}
+
+#[inline(always)]
+fn hash_name(name: &str) -> u64 {
+    let mut hasher = DefaultHasher::new();
+    name.hash(&mut hasher);
+    hasher.finish()
+}
+
+/// Calls `f` for each meaningful line read from `reader`.
+fn for_each_line<R: BufRead, F: FnMut(ConfLine<'_>)>(mut reader: R, mut f: F) -> Result<(), Error> {
+    let mut buf = Vec::new();
+    loop {
+        buf.clear();
+        if reader.read_until(b'\n', &mut buf).map_err(Error::IoError)? == 0 {
+            return Ok(());
+        }
+        let s = std::str::from_utf8(&buf)
+            .map_err(|e| Error::IoError(io::Error::new(io::ErrorKind::InvalidData, e)))?;
+        for line in s.split(&['\r', '\n', ';']) {
+            if let Some(line) = ConfLine::parse(line) {
+                f(line);
+            }
+        }
+    }
+}
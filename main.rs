@@ -3,17 +3,29 @@ use std::{
     io::{self, Write},
     path::{Path, PathBuf},
     str::FromStr,
-    time::Duration,
+    time::{Duration, Instant},
 };
 
 const MSG_HELP: &str = "\
-random-picker [conf|calc|test] <table_file> [pick_amount] [-n] [-f]
+random-picker [conf|calc|test|serve|bench] <table_file> [pick_amount] [-n] [-f] [--rng=<name>] [-j<threads>] [--stats]
+random-picker compile <table_file> <binary_file>
 Description:
 conf    Create the table file by user input
+compile Convert the table file into the binary format, which can be given as
+        `table_file` of other operations (it is not parsed before picking)
 calc    Calculate and print probabilities of being picked up
 test    Generate some amount of results and print the frequency table
+serve   Load the table once, then read requests from stdin line by line, each
+        is `[amount] [groups]` (default: `pick_amount` and 1 group), and print
+        a line of items for each group
+bench   Measure speed of all random sources and picking methods, print CSV lines
+        (built-in tables of different sizes are used if `table_file` is not given)
 -n      Do not print warning for the nonuniform distribution
 -f      Use the fast pseudo random generator instead of OS random source
+--rng   Random source: os (default), thread (same as `-f`), xoshiro, pcg, chacha8
+-j      Amount of threads for `test` (default: 1, `-j0`: all available cores)
+--stats Print counters of the picker to stderr after `pick`, `test` or `serve`
+        (the program must be built with the `stats` feature)
 Note:
 `pick_amount` is set to 1 if not given, and it makes no sense with `conf`.
 When repetitive mode is off, `pick_amount` must not exceed the table length.
@@ -23,9 +35,35 @@ More information: <https://crates.io/crates/random-picker/0.2.3>
 struct Params {
     operation: Operation,
     table_path: PathBuf,
+    output_path: PathBuf,
     pick_amount: usize,
     know_nonuniform: bool,
-    use_fast_rng: bool,
+    rng: RngKind,
+    threads: usize,
+    stats: bool,
+}
+
+#[derive(Clone, Copy, PartialEq, Eq)]
+enum RngKind {
+    Os,
+    Thread,
+    Xoshiro,
+    Pcg,
+    ChaCha8,
+}
+
+impl FromStr for RngKind {
+    type Err = &'static str;
+    fn from_str(s: &str) -> Result<Self, Self::Err> {
+        match s {
+            "os" => Ok(Self::Os),
+            "thread" => Ok(Self::Thread),
+            "xoshiro" => Ok(Self::Xoshiro),
+            "pcg" => Ok(Self::Pcg),
+            "chacha8" => Ok(Self::ChaCha8),
+            _ => Err("Unknown random source"),
+        }
+    }
 }
 
 #[derive(PartialEq, Eq)]
@@ -34,6 +72,9 @@ enum Operation {
     Pick,
     Calc,
     Test,
+    Serve,
+    Bench,
+    Compile,
 }
 
 impl Params {
@@ -41,9 +82,12 @@ impl Params {
         let mut params = Self {
             operation: Operation::Pick,
             table_path: PathBuf::new(),
+            output_path: PathBuf::new(),
             pick_amount: 1,
             know_nonuniform: false,
-            use_fast_rng: false,
+            rng: RngKind::Os,
+            threads: 1,
+            stats: false,
         };
 
         let cur_exe = env::current_exe().unwrap_or_default();
@@ -54,9 +98,21 @@ impl Params {
                 "conf" => params.operation = Operation::Conf,
                 "calc" => params.operation = Operation::Calc,
                 "test" => params.operation = Operation::Test,
+                "serve" => params.operation = Operation::Serve,
+                "bench" => params.operation = Operation::Bench,
+                "compile" => params.operation = Operation::Compile,
                 "-n" => params.know_nonuniform = true,
-                "-f" => params.use_fast_rng = true,
+                "-f" => params.rng = RngKind::Thread,
+                "--stats" => params.stats = true,
                 _ => {
+                    if let Some(name) = arg.strip_prefix("--rng=") {
+                        params.rng = RngKind::from_str(name)?;
+                        continue;
+                    }
+                    if let Some(Ok(n)) = arg.strip_prefix("-j").map(usize::from_str) {
+                        params.threads = n;
+                        continue;
+                    }
                     if let Ok(n) = usize::from_str(&arg) {
                         params.pick_amount = n;
                         continue;
@@ -65,7 +121,10 @@ impl Params {
                     if path.file_name() == cur_exe_name {
                         continue;
                     }
-                    if let Ok(true) = path.try_exists() {
+                    let compile = params.operation == Operation::Compile;
+                    if compile && params.table_path != PathBuf::new() {
+                        params.output_path = path.to_path_buf();
+                    } else if let Ok(true) = path.try_exists() {
                         params.table_path = path.to_path_buf();
                     } else if params.operation == Operation::Conf {
                         params.table_path = path.to_path_buf();
@@ -74,7 +133,9 @@ impl Params {
             }
         }
 
-        if params.table_path != PathBuf::new() {
+        if params.operation == Operation::Compile && params.output_path == PathBuf::new() {
+            Err("Binary file is not given")
+        } else if params.table_path != PathBuf::new() || params.operation == Operation::Bench {
             Ok(params)
         } else {
             Err("Table file not found")
@@ -89,11 +150,75 @@ fn main() {
         std::process::exit(1);
     });
 
+    use rand::{
+        rngs::{OsRng, StdRng},
+        SeedableRng,
+    };
+    use random_picker::{rngs::*, Error, TableFile};
     use Operation::*;
+    if params.operation == Compile {
+        let table = load_table(&params.table_path).unwrap_or_else(|e| {
+            eprintln!("Failed to open table file: {e}");
+            std::process::exit(1);
+        });
+        let result = fs::File::create(&params.output_path)
+            .map_err(Error::IoError)
+            .and_then(|f| table.write_binary(io::BufWriter::new(f)));
+        if let Err(e) = result {
+            eprintln!("Failed to save file: {e}");
+            std::process::exit(1);
+        }
+        return;
+    }
+    if matches!(params.operation, Pick | Test | Serve) {
+        let table = match TableFile::open(&params.table_path) {
+            Ok(file) => PickerTable::File(file),
+            Err(_) => PickerTable::Compiled(load_table(&params.table_path).unwrap_or_else(|e| {
+                eprintln!("Failed to open table file: {e}");
+                std::process::exit(1);
+            })),
+        };
+        match params.rng {
+            RngKind::Os => run_picker(&params, table, BufferedRng::new(OsRng), |_| {
+                Ok(BufferedRng::new(OsRng))
+            }),
+            RngKind::Thread => run_picker(&params, table, rand::thread_rng(), |rng| {
+                StdRng::from_rng(rng).map_err(Error::RandError)
+            }),
+            RngKind::Xoshiro => {
+                let rng = Xoshiro256PlusPlus::from_rng(OsRng).expect("Failed to seed");
+                run_picker(&params, table, rng, |rng| Ok(rng.split()))
+            }
+            RngKind::Pcg => {
+                let rng = Pcg64::from_rng(OsRng).expect("Failed to seed");
+                run_picker(&params, table, rng, |rng| Ok(rng.split()))
+            }
+            RngKind::ChaCha8 => {
+                let rng = ChaCha8Rng::from_rng(OsRng).expect("Failed to seed");
+                run_picker(&params, table, rng, |rng| Ok(rng.split()))
+            }
+        }
+        return;
+    }
 
     let mut conf = random_picker::Config::new();
-    if let Ok(s) = fs::read_to_string(&params.table_path) {
-        conf.append_str(&s);
+    if let Ok(table) = TableFile::open(&params.table_path).and_then(|mut file| file.load()) {
+        conf = table.to_config();
+    } else if let Ok(f) = fs::File::open(&params.table_path) {
+        let _ = conf.append_from(io::BufReader::new(f));
+    }
+    if params.operation == Operation::Bench {
+        let tables = if params.table_path != PathBuf::new() {
+            if conf.check().is_err() {
+                eprintln!("Failed to open table file");
+                std::process::exit(1);
+            }
+            vec![(conf, params.pick_amount)]
+        } else {
+            bench_tables()
+        };
+        bench(&tables);
+        return;
     }
     if params.operation != Operation::Conf {
         if conf.check().is_err() {
@@ -106,68 +231,309 @@ fn main() {
         return;
     }
 
-    use random_picker::Picker;
-    match params.operation {
-        Pick => {
-            let is_fair = conf.is_fair();
-            let result = if !params.use_fast_rng {
-                random_picker::pick(params.pick_amount, conf)
-            } else {
-                let mut picker = Picker::build_with_rng(conf, rand::thread_rng()).unwrap();
-                picker.pick(params.pick_amount)
-            };
-            match result {
-                Ok(table) => {
-                    for item in table {
-                        print!("{item} ");
-                    }
-                    if !is_fair && !params.know_nonuniform {
-                        print!("(nonuniform)");
-                    }
-                    println!();
+    if params.operation == Calc {
+        let mut table = random_picker::Table::new();
+        println!("Calculating, please wait...");
+        let time_cost = measure_exec_time(|| {
+            table = calc_with_progress(&conf, params.pick_amount).unwrap_or_else(|e| {
+                eprintln!("Error: {e}");
+                std::process::exit(1);
+            });
+        });
+        println!("Time passed: {} ms", time_cost.as_millis());
+        table.iter_mut().for_each(|(_, val)| *val *= 100.);
+        random_picker::print_table(&table);
+    }
+}
+
+/// Loads a binary table file, or compiles a text table file while reading it
+/// (without building `Config`).
+fn load_table(path: &Path) -> Result<random_picker::CompiledTable<String>, random_picker::Error> {
+    use random_picker::{CompiledTable, Error, TableFile};
+    if let Ok(mut file) = TableFile::open(path) {
+        return file.load();
+    }
+    let file = fs::File::open(path).map_err(Error::IoError)?;
+    CompiledTable::read_from(io::BufReader::new(file))
+}
+
+/// Table for `Pick`, `Test` and `Serve`. A binary table file is not loaded entirely for `Pick`.
+enum PickerTable {
+    Compiled(random_picker::CompiledTable<String>),
+    File(random_picker::TableFile),
+}
+
+/// Calculates probabilities in another thread, and prints the progress every second.
+fn calc_with_progress(
+    conf: &random_picker::Config<String>,
+    pick_amount: usize,
+) -> Result<random_picker::Table<String>, random_picker::Error> {
+    use random_picker::{CalcOptions, CalcProgress};
+    use std::sync::Arc;
+    let progress = Arc::new(CalcProgress::new());
+    let options = CalcOptions {
+        progress: Some(progress.clone()),
+        ..Default::default()
+    };
+    std::thread::scope(|s| {
+        let hdl = s.spawn(|| conf.calc_probabilities_with(pick_amount, &options));
+        let mut t_print = Instant::now();
+        let mut printed = false;
+        while !hdl.is_finished() {
+            std::thread::sleep(Duration::from_millis(20));
+            if t_print.elapsed() < Duration::from_secs(1) {
+                continue;
+            }
+            t_print = Instant::now();
+            let eta = progress.eta().map(|t| format!("{} s", t.as_secs()));
+            print!(
+                "\r{:6.2}% done, {:.3e} nodes/s, ETA: {}   ",
+                progress.fraction() * 100.,
+                progress.nodes_per_sec(),
+                eta.as_deref().unwrap_or("unknown")
+            );
+            let _ = io::stdout().flush();
+            printed = true;
+        }
+        if printed {
+            println!();
+        }
+        hdl.join().map_err(|_| random_picker::Error::ThreadError)?
+    })
+}
+
+/// Does the `Pick` or `Test` operation with the random source `rng`;
+/// workers of the parallel test get their random sources from `fork_rng`.
+fn run_picker<R, W, F>(params: &Params, table: PickerTable, mut rng: R, fork_rng: F)
+where
+    R: rand::RngCore,
+    W: rand::RngCore + Send,
+    F: FnMut(&mut R) -> Result<W, random_picker::Error>,
+{
+    let table = match table {
+        PickerTable::File(mut file) if params.operation == Operation::Pick => {
+            let result = file.pick(params.pick_amount, &mut rng);
+            print_picks(params, result, file.is_fair());
+            if params.stats {
+                eprintln!("Statistics are not available for picking from a binary file");
+            }
+            return;
+        }
+        PickerTable::File(mut file) => file.load().unwrap_or_else(|e| {
+            eprintln!("Failed to open table file: {e}");
+            std::process::exit(1);
+        }),
+        PickerTable::Compiled(table) => table,
+    };
+    let is_fair = table.is_fair();
+    let mut picker = random_picker::Picker::from_table(std::sync::Arc::new(table), rng);
+    if params.operation == Operation::Pick {
+        print_picks(params, picker.pick(params.pick_amount), is_fair);
+        print_stats(params, &picker);
+        return;
+    }
+    if params.operation == Operation::Serve {
+        if let Err(e) = serve(params, &mut picker) {
+            eprintln!("Error: {e}");
+            std::process::exit(1);
+        }
+        print_stats(params, &picker);
+        return;
+    }
+
+    print!("Input amount of result groups for making statistics: ");
+    let _ = io::stdout().flush();
+    let test_times = if let Some(Ok(input)) = io::stdin().lines().next() {
+        input.trim().parse().unwrap_or(5_000_000)
+    } else {
+        5_000_000
+    };
+    println!("Testing for {test_times} times, please wait...");
+    let mut table = random_picker::Table::new();
+    let time_cost = measure_exec_time(|| {
+        let (amount, threads) = (params.pick_amount, params.threads);
+        let result = if threads != 1 {
+            picker.test_freqs_parallel(amount, test_times, threads, fork_rng)
+        } else {
+            picker.test_freqs(amount, test_times)
+        };
+        if let Err(e) = result {
+            eprintln!("Error: {e}");
+            std::process::exit(1);
+        }
+        table = result.unwrap();
+    });
+    println!("Time passed: {} ms", time_cost.as_millis());
+    table.iter_mut().for_each(|(_, val)| *val *= 100.);
+    random_picker::print_table(&table);
+    print_stats(params, &picker);
+}
+
+/// Prints counters of the picker to stderr if `--stats` is given.
+fn print_stats<R: rand::RngCore>(params: &Params, _picker: &random_picker::Picker<String, R>) {
+    if !params.stats {
+        return;
+    }
+    #[cfg(feature = "stats")]
+    eprintln!("{}", _picker.stats());
+    #[cfg(not(feature = "stats"))]
+    eprintln!("Statistics are not available: the program is built without the `stats` feature");
+}
+
+fn print_picks(params: &Params, result: Result<Vec<String>, random_picker::Error>, is_fair: bool) {
+    match result {
+        Ok(table) => {
+            for item in table {
+                print!("{item} ");
+            }
+            if !is_fair && !params.know_nonuniform {
+                print!("(nonuniform)");
+            }
+            println!();
+        }
+        Err(e) => eprintln!("Error: {e}"),
+    }
+}
+
+/// Answers requests from stdin until EOF. The output is written into a buffer,
+/// which is flushed when there is no more buffered input, so that batches of
+/// requests are answered with few writes while interactive use still works.
+/// An invalid request gets a line starting with `Error:`.
+fn serve<R: rand::RngCore>(
+    params: &Params,
+    picker: &mut random_picker::Picker<String, R>,
+) -> io::Result<()> {
+    use io::BufRead;
+    const SERVE_BATCH: usize = 1 << 16;
+    let mut reader = io::BufReader::with_capacity(1 << 16, io::stdin());
+    let mut out = io::BufWriter::with_capacity(1 << 16, io::stdout().lock());
+    let (mut line, mut indexes) = (String::new(), Vec::new());
+    while {
+        line.clear();
+        reader.read_line(&mut line)? > 0
+    } {
+        let mut spl = line.split_whitespace().map(usize::from_str);
+        let (amount, groups) = match (spl.next(), spl.next(), spl.next()) {
+            (None, _, _) => (params.pick_amount, 1),
+            (Some(Ok(amount)), None, _) => (amount, 1),
+            (Some(Ok(amount)), Some(Ok(groups)), None) => (amount, groups),
+            _ => {
+                writeln!(out, "Error: invalid request")?;
+                continue;
+            }
+        };
+        // large requests are done in batches of groups to limit memory usage
+        let batch = (SERVE_BATCH / amount.max(1)).max(1);
+        let mut remaining = groups;
+        while remaining > 0 {
+            let cnt = remaining.min(batch);
+            remaining -= cnt;
+            indexes.resize(amount * cnt, 0);
+            if let Err(e) = picker.write_index_groups_to(amount, &mut indexes) {
+                writeln!(out, "Error: {e}")?;
+                break;
+            }
+            let keys = picker.keys();
+            for g in 0..cnt {
+                for &i in &indexes[g * amount..(g + 1) * amount] {
+                    out.write_all(keys[i].as_bytes())?;
+                    out.write_all(b" ")?;
                 }
-                Err(e) => eprintln!("Error: {e}"),
+                out.write_all(b"\n")?;
             }
         }
-        Calc => {
-            let mut table = random_picker::Table::new();
-            println!("Calculating, please wait...");
-            let time_cost = measure_exec_time(|| {
-                table = conf.calc_probabilities(params.pick_amount).unwrap();
-            });
-            println!("Time passed: {} ms", time_cost.as_millis());
-            table.iter_mut().for_each(|(_, val)| *val *= 100.);
-            random_picker::print_table(&table);
+        if reader.buffer().is_empty() {
+            out.flush()?;
         }
-        Test => {
-            print!("Input amount of result groups for making statistics: ");
-            let _ = io::stdout().flush();
-            let test_times = if let Some(Ok(input)) = io::stdin().lines().next() {
-                input.trim().parse().unwrap_or(5_000_000)
-            } else {
-                5_000_000
-            };
-            println!("Testing for {test_times} times, please wait...");
-            let mut table = random_picker::Table::new();
-            let time_cost = measure_exec_time(|| {
-                let result = if !params.use_fast_rng {
-                    let mut picker = Picker::build(conf).unwrap();
-                    picker.test_freqs(params.pick_amount, test_times)
-                } else {
-                    let mut picker = Picker::build_with_rng(conf, rand::thread_rng()).unwrap();
-                    picker.test_freqs(params.pick_amount, test_times)
-                };
-                if let Err(e) = result {
-                    eprintln!("Error: {e}");
-                    std::process::exit(1);
+    }
+    out.flush()
+}
+
+/// Pairs of the table and the pick amount: repetitive picking of 1 item and
+/// non-repetitive picking of 8 items, with tables of 16 to 65536 items.
+fn bench_tables() -> Vec<(random_picker::Config<String>, usize)> {
+    let mut tables = Vec::new();
+    for table_len in [16, 256, 4096, 65536] {
+        let mut conf = random_picker::Config::new();
+        for i in 0..table_len {
+            conf.table.insert(format!("{i}"), (i % 100 + 1) as f64);
+        }
+        for (repetitive, amount) in [(true, 1), (false, 8)] {
+            conf.repetitive = repetitive;
+            tables.push((conf.clone(), amount));
+        }
+    }
+    tables
+}
+
+/// Prints the CSV header and lines of `bench_rng()` for each random source.
+/// The OS random source is measured both without and with `BufferedRng`.
+fn bench(tables: &[(random_picker::Config<String>, usize)]) {
+    use rand::{rngs::OsRng, SeedableRng};
+    use random_picker::rngs::*;
+    println!(
+        "rng,method,table_len,repetitive,amount,picks,items_per_sec,picks_per_sec,ns_per_pick"
+    );
+    bench_rng("os", tables, || OsRng);
+    bench_rng("os-buffered", tables, || BufferedRng::new(OsRng));
+    bench_rng("thread", tables, rand::thread_rng);
+    bench_rng("xoshiro", tables, || {
+        Xoshiro256PlusPlus::from_rng(OsRng).expect("Failed to seed")
+    });
+    bench_rng("pcg", tables, || {
+        Pcg64::from_rng(OsRng).expect("Failed to seed")
+    });
+    bench_rng("chacha8", tables, || {
+        ChaCha8Rng::from_rng(OsRng).expect("Failed to seed")
+    });
+}
+
+/// Picks groups of indexes repeatedly for at least `BENCH_TIME` with each
+/// table and each method, and prints a CSV line for each of them.
+/// `items_per_sec` counts picked items, not draws of the sampler (which
+/// include rejected draws in non-repetitive mode).
+fn bench_rng<R, F>(
+    rng_name: &str,
+    tables: &[(random_picker::Config<String>, usize)],
+    mut new_rng: F,
+) where
+    R: rand::RngCore,
+    F: FnMut() -> R,
+{
+    const BENCH_TIME: Duration = Duration::from_millis(100);
+    const BENCH_BATCH: usize = 1000;
+    use random_picker::{PickMethod, Picker};
+    use PickMethod::*;
+
+    for (conf, amount) in tables {
+        for method in [Alias, Grid, Fixed, Tree] {
+            let mut picker = Picker::build_with_rng(conf.clone(), new_rng()).unwrap();
+            picker.set_method(method);
+            let mut dest = vec![0; *amount];
+            let (mut picks, t_start) = (0, Instant::now());
+            let elapsed = loop {
+                for _ in 0..BENCH_BATCH {
+                    if let Err(e) = picker.write_indexes_to(&mut dest) {
+                        eprintln!("Error: {e}");
+                        std::process::exit(1);
+                    }
                 }
-                table = result.unwrap();
-            });
-            println!("Time passed: {} ms", time_cost.as_millis());
-            table.iter_mut().for_each(|(_, val)| *val *= 100.);
-            random_picker::print_table(&table);
+                picks += BENCH_BATCH;
+                let elapsed = t_start.elapsed();
+                if elapsed >= BENCH_TIME {
+                    break elapsed.as_secs_f64();
+                }
+            };
+            println!(
+                "{rng_name},{},{},{},{amount},{picks},{:.0},{:.0},{:.2}",
+                format!("{method:?}").to_lowercase(),
+                picker.table_len(),
+                conf.repetitive,
+                (picks * amount) as f64 / elapsed,
+                picks as f64 / elapsed,
+                elapsed * 1e9 / picks as f64
+            );
         }
-        _ => (),
     }
 }
 
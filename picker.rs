@@ -1,6 +1,30 @@
-use crate::*;
+use crate::{bits::BitSet, config::ConfLine, search, stats::Counters, tree::FenwickTree, *};
 use rand::{rngs::OsRng, RngCore};
-use std::hash::Hash;
+use std::{collections::HashMap, hash::Hash, sync::Arc};
+
+/// Sampling method used by `Picker` for each single draw.
+#[derive(Clone, Copy, PartialEq, Eq, Debug, Default)]
+pub enum PickMethod {
+    /// Walker's alias method: O(1) per draw, the table is built once in
+    /// `Picker::configure()`. It consumes 8 bytes from the RNG for each draw.
+    #[default]
+    Alias,
+    /// Binary search in the cumulative grid: O(log n) per draw, consumes 4 bytes
+    /// from the RNG for each draw (same results as version 0.2.3 and earlier).
+    Grid,
+    /// Binary search in the cumulative grid of weights quantized into integers
+    /// (62-bit fixed-point values): O(log n) per draw, consumes 8 bytes from the
+    /// RNG for each draw. There is no floating-point operation in each draw, and
+    /// each item is picked with probability (quantized weight) / 2^62 exactly.
+    Fixed,
+    /// Searching in a Fenwick tree: O(log n) per draw, consumes 8 bytes
+    /// from the RNG for each draw. `Picker::set_weight()` takes O(log n) time
+    /// in this mode, which suits tables whose weights are changed frequently.
+    Tree,
+}
+
+/// Amount of draws whose random bytes are requested at once in batch operations.
+const DRAW_BLOCK: usize = 64;
 
 /// Generator of groups of random items of type `T` with different probabilities.
 /// According to the configuration, items in each group can be either
@@ -8,13 +32,19 @@ use std::hash::Hash;
 pub struct Picker<T: Clone + Eq + Hash, R: RngCore> {
     rng: R,
 
-    table: Vec<(T, f64)>,
-    grid: Vec<f64>,
-    grid_width: f64,
-    repetitive: bool,
+    table: Arc<CompiledTable<T>>, // copied on write if it is shared
+    grid_width: f64,              // sum of weights
+    fenwick: FenwickTree,         // used by `PickMethod::Tree`
+    method: PickMethod,
+    removal: FenwickTree, // used in `pick_indexes_removal()`
+    removal_valid: bool,
+    removal_ops: usize,
+    key_indexes: HashMap<T, usize>, // built by `index_of()` if empty
 
-    table_picked: Vec<bool>,    // used in `pick_indexes()`, size: table.len()
+    table_picked: BitSet,       // used in `pick_indexes()`, size: table.len()
     picked_indexes: Vec<usize>, // read it after calling `pick_indexes()`
+
+    pub(crate) counters: Counters, // only updated with the `stats` feature
 }
 
 impl<T: Clone + Eq + Hash> Picker<T, OsRng> {
@@ -27,39 +57,248 @@ impl<T: Clone + Eq + Hash> Picker<T, OsRng> {
 impl<T: Clone + Eq + Hash, R: RngCore> Picker<T, R> {
     /// Builds the `Picker` with given configuration and the given random source.
     pub fn build_with_rng(conf: Config<T>, rng: R) -> Result<Self, Error> {
-        let table_len = conf.table.len();
+        let table = CompiledTable::build(conf)?;
+        Ok(Self::from_table(Arc::new(table), rng))
+    }
+
+    /// Builds the `Picker` with a shared compiled table and the given random source.
+    /// It only allocates O(table.len() / 64) bytes (if `PickMethod::Tree`
+    /// is not used), and no item is copied.
+    pub fn from_table(table: Arc<CompiledTable<T>>, rng: R) -> Self {
         let mut picker = Self {
             rng,
-            table: Vec::with_capacity(table_len),
-            grid: Vec::with_capacity(table_len),
-            grid_width: 0.,
-            repetitive: conf.repetitive,
-            table_picked: Vec::with_capacity(table_len),
-            picked_indexes: Vec::with_capacity(table_len),
+            grid_width: table.total_weight(),
+            table,
+            fenwick: FenwickTree::default(),
+            method: PickMethod::default(),
+            removal: FenwickTree::default(),
+            removal_valid: false,
+            removal_ops: 0,
+            key_indexes: HashMap::new(),
+            table_picked: BitSet::default(),
+            picked_indexes: Vec::new(),
+            counters: Counters::default(),
         };
-        picker.configure(conf)?;
-        Ok(picker)
+        picker.set_table(picker.table.clone());
+        picker
     }
 
     /// Applies new configuration.
     pub fn configure(&mut self, conf: Config<T>) -> Result<(), Error> {
-        self.table = conf.vec_table()?;
-        let table_len = self.table.len();
+        let timer = Counters::timer();
+        let table = CompiledTable::build(conf)?;
+        self.set_table(Arc::new(table));
+        self.counters.configured(timer);
+        Ok(())
+    }
+
+    /// Replaces the compiled table, which may be shared with other `Picker`s.
+    pub fn set_table(&mut self, table: Arc<CompiledTable<T>>) {
+        let table_len = table.len();
+        self.table = table;
+        self.rebuild_sampler();
+        self.removal_valid = false;
+        self.key_indexes.clear();
+
+        self.table_picked.resize_clear(table_len);
+        self.picked_indexes.reserve(table_len);
+    }
+
+    /// Returns the compiled table being used, which can be shared with other `Picker`s.
+    #[inline(always)]
+    pub fn table(&self) -> &Arc<CompiledTable<T>> {
+        &self.table
+    }
+
+    /// Returns instrumentation counters accumulated since the `Picker` is built
+    /// or `reset_stats()` is called. It is only available with the `stats` feature;
+    /// without it, counters are not kept at all.
+    ///
+    /// ```
+    /// use random_picker::{Config, PickMethod, Picker};
+    /// let conf: Config<String> = "a=1;b=2;c=3;d=4;repetitive=true".parse().unwrap();
+    /// let mut picker = Picker::build(conf).unwrap();
+    /// picker.set_method(PickMethod::Grid);
+    /// picker.reset_stats();
+    /// picker.pick(3).unwrap();
+    /// let stats = picker.stats();
+    /// assert_eq!((stats.draws, stats.rejected_draws), (3, 0));
+    /// assert_eq!((stats.rng_bytes, stats.rng_calls), (12, 3));
+    /// assert_eq!(stats.grid_searches, 3);
+    /// ```
+    #[cfg(feature = "stats")]
+    #[inline(always)]
+    pub fn stats(&self) -> PickerStats {
+        self.counters.stats()
+    }
+
+    /// Resets counters returned by `stats()`.
+    #[cfg(feature = "stats")]
+    #[inline(always)]
+    pub fn reset_stats(&mut self) {
+        self.counters = Counters::default();
+    }
+
+    /// Returns the current sampling method.
+    #[inline(always)]
+    pub fn method(&self) -> PickMethod {
+        self.method
+    }
+
+    /// Switches to another sampling method. The distribution of results is
+    /// not affected, but the amount of random bytes consumed for each draw may change.
+    ///
+    /// ```
+    /// use random_picker::{Picker, PickMethod};
+    /// let conf: random_picker::Config<String> = "a=1;b=2;c=3".parse().unwrap();
+    /// let mut picker = Picker::build(conf).unwrap();
+    /// assert_eq!(picker.method(), PickMethod::Alias);
+    /// picker.set_method(PickMethod::Grid);
+    /// assert_eq!(picker.pick(3).unwrap().len(), 3);
+    /// ```
+    pub fn set_method(&mut self, method: PickMethod) {
+        if method != self.method {
+            self.method = method;
+            self.rebuild_sampler();
+        }
+    }
+
+    /// Modifies the weight value of an existing item without calling `configure()`.
+    /// `weight` is treated like a value in `Config::table`, and it must be positive.
+    /// It costs O(log n) with `PickMethod::Tree`; sampling structures of other
+    /// methods are invalidated and rebuilt in O(n) on the next pick, so a batch of
+    /// modifications costs one rebuild (the first call also builds an index of keys).
+    /// The compiled table is copied if it is shared with other `Picker`s
+    /// (see `Arc::make_mut()`).
+    ///
+    /// ```
+    /// use random_picker::{Picker, PickMethod};
+    /// let conf: random_picker::Config<String> = "a=1;b=1000000".parse().unwrap();
+    /// let mut picker = Picker::build(conf).unwrap();
+    /// picker.set_method(PickMethod::Tree);
+    /// picker.set_weight(&"a".to_string(), 1e15).unwrap();
+    /// assert_eq!(picker.pick(1).unwrap()[0], "a");
+    /// assert!(picker.set_weight(&"c".to_string(), 1.).is_err());
+    /// assert!(picker.set_weight(&"b".to_string(), 0.).is_err());
+    /// ```
+    pub fn set_weight(&mut self, key: &T, weight: f64) -> Result<(), Error> {
+        let i = self.index_of(key).ok_or(Error::InvalidTable)?;
+        self.set_weight_at(i, weight)
+    }
 
-        self.grid.clear();
-        self.grid.reserve(table_len);
-        let mut cur = 0.;
-        for (_, val) in &self.table {
-            cur += val;
-            self.grid.push(cur);
+    /// Does the same thing as `set_weight()` for the item of index `i`.
+    pub fn set_weight_at(&mut self, i: usize, weight: f64) -> Result<(), Error> {
+        let weight = self.compiled_weight(weight)?;
+        if i >= self.table_len() {
+            return Err(Error::InvalidTable);
         }
-        self.grid_width = *self.grid.last().unwrap();
 
-        self.repetitive = conf.repetitive;
+        let delta = Arc::make_mut(&mut self.table).set_weight(i, weight);
+        if self.removal_valid {
+            self.removal.add(i, delta);
+            self.removal_ops += 1;
+        }
+        if self.method == PickMethod::Tree {
+            self.fenwick.add(i, delta);
+        }
+        self.update_grid_width();
+        Ok(())
+    }
+
+    /// Inserts an item, or modifies the weight of an existing item, like `name = val`
+    /// in `Config::append_str()`: `weight` is treated like a value in `Config::table`,
+    /// and an item of weight 0 is removed (if the table is not `inversed`).
+    /// The time cost is the same as `set_weight()`; a new item gets the last index.
+    ///
+    /// ```
+    /// use random_picker::{Picker, PickMethod};
+    /// let conf: random_picker::Config<String> = "a=1;b=2".parse().unwrap();
+    /// let mut picker = Picker::build(conf).unwrap();
+    /// picker.set_method(PickMethod::Tree);
+    /// picker.insert("c".to_string(), 1e15).unwrap();
+    /// assert_eq!(picker.pick(1).unwrap()[0], "c");
+    /// picker.insert("c".to_string(), 0.).unwrap();
+    /// assert_eq!(picker.table_len(), 2);
+    /// assert!(picker.insert("d".to_string(), -1.).is_err());
+    /// ```
+    pub fn insert(&mut self, key: T, weight: f64) -> Result<(), Error> {
+        let removing = weight == 0. && !self.table.inversed();
+        match self.index_of(&key) {
+            Some(i) if removing => self.remove_at(i),
+            Some(i) => self.set_weight_at(i, weight),
+            None if removing => Ok(()),
+            None => {
+                let weight = self.compiled_weight(weight)?;
+                let i = self.table_len();
+                Arc::make_mut(&mut self.table).push(key.clone(), weight);
+                self.key_indexes.insert(key, i);
+                if self.removal_valid {
+                    self.removal.push(weight);
+                    self.removal_ops += 1;
+                }
+                if self.method == PickMethod::Tree {
+                    self.fenwick.push(weight);
+                }
+                self.update_grid_width();
+                self.table_picked.resize(i + 1);
+                Ok(())
+            }
+        }
+    }
 
-        self.table_picked.resize(table_len, false);
-        self.picked_indexes.reserve(table_len);
+    /// Removes an item, like `delete <name>` in `Config::append_str()`; the last
+    /// item takes its index. Returns `false` if the item doesn't exist, or an error
+    /// if it is the only item. The time cost is the same as `set_weight()`.
+    ///
+    /// ```
+    /// let conf: random_picker::Config<String> = "a=1;b=2;c=3".parse().unwrap();
+    /// let mut picker = random_picker::Picker::build(conf).unwrap();
+    /// assert_eq!(picker.remove(&"a".to_string()).unwrap(), true);
+    /// assert_eq!(picker.remove(&"a".to_string()).unwrap(), false);
+    /// assert_eq!(picker.table_len(), 2);
+    /// assert!(picker.pick(2).unwrap().iter().all(|k| k != "a"));
+    /// picker.remove(&"b".to_string()).unwrap();
+    /// assert!(picker.remove(&"c".to_string()).is_err());
+    /// ```
+    pub fn remove(&mut self, key: &T) -> Result<bool, Error> {
+        match self.index_of(key) {
+            Some(i) => self.remove_at(i).map(|_| true),
+            None => Ok(false),
+        }
+    }
 
+    /// Does the same thing as `remove()` for the item of index `i`.
+    pub fn remove_at(&mut self, i: usize) -> Result<(), Error> {
+        let last = self.table_len() - 1;
+        if i > last || last == 0 {
+            return Err(Error::InvalidTable);
+        }
+
+        let w_last = self.table.weights()[last];
+        let (key, weight) = Arc::make_mut(&mut self.table).swap_remove(i);
+        if !self.key_indexes.is_empty() {
+            self.key_indexes.remove(&key);
+            if i < last {
+                self.key_indexes.insert(self.table.keys()[i].clone(), i);
+            }
+        }
+        // the last weight is moved to index `i`
+        let mut trees = Vec::with_capacity(2);
+        if self.removal_valid {
+            trees.push(&mut self.removal);
+            self.removal_ops += 1;
+        }
+        if self.method == PickMethod::Tree {
+            trees.push(&mut self.fenwick);
+        }
+        for tree in trees {
+            tree.pop();
+            if i < last {
+                tree.add(i, w_last - weight);
+            }
+        }
+        self.update_grid_width();
+        self.table_picked.resize(last);
         Ok(())
     }
 
@@ -80,6 +319,30 @@ impl<T: Clone + Eq + Hash, R: RngCore> Picker<T, R> {
         self.table.len()
     }
 
+    /// Returns the item of index `i` (`i < table_len()`), without cloning it.
+    /// Indexes are valid until the `Picker` is reconfigured or an item is removed.
+    #[inline(always)]
+    pub fn key(&self, i: usize) -> Option<&T> {
+        self.table.key(i)
+    }
+
+    /// Returns all items in the order of their indexes.
+    #[inline(always)]
+    pub fn keys(&self) -> &[T] {
+        self.table.keys()
+    }
+
+    /// Returns the index of the item. An index of all keys is built
+    /// on the first call (after each `configure()`), then it costs O(1).
+    pub fn index_of(&mut self, key: &T) -> Option<usize> {
+        if self.key_indexes.is_empty() {
+            self.key_indexes = (self.table.keys().iter().enumerate())
+                .map(|(i, k)| (k.clone(), i))
+                .collect();
+        }
+        self.key_indexes.get(key).copied()
+    }
+
     /// Picks `amount` of items and returns the group of items.
     /// `amount` must not exceed `table_len()`.
     #[inline(always)]
@@ -103,6 +366,80 @@ impl<T: Clone + Eq + Hash, R: RngCore> Picker<T, R> {
         Ok(())
     }
 
+    /// Picks `dest.len()` of items and writes their indexes into `dest`,
+    /// without cloning any item. Length of `dest` must not exceed `table_len()`.
+    ///
+    /// ```
+    /// let conf: random_picker::Config<String> = "a=1;b=2;c=3".parse().unwrap();
+    /// let mut picker = random_picker::Picker::build(conf).unwrap();
+    /// let mut indexes = [0; 2];
+    /// picker.write_indexes_to(&mut indexes).unwrap();
+    /// assert_ne!(picker.key(indexes[0]), picker.key(indexes[1]));
+    /// let key = picker.key(indexes[0]).unwrap().clone();
+    /// assert_eq!(picker.index_of(&key), Some(indexes[0]));
+    /// ```
+    #[inline]
+    pub fn write_indexes_to(&mut self, dest: &mut [usize]) -> Result<(), Error> {
+        self.pick_indexes(dest.len())?;
+        dest.copy_from_slice(&self.picked_indexes);
+        Ok(())
+    }
+
+    /// Picks `dest.len() / amount` groups of `amount` items, and writes them into
+    /// `dest` group by group. `dest.len()` must be a multiple of `amount`.
+    /// Checks are done only once for all groups.
+    ///
+    /// ```
+    /// let conf: random_picker::Config<String> = "a=1;b=2;c=3".parse().unwrap();
+    /// let mut picker = random_picker::Picker::build(conf).unwrap();
+    /// let mut groups = vec![String::new(); 2 * 1000];
+    /// picker.write_groups_to(2, &mut groups).unwrap();
+    /// assert!(groups.chunks(2).all(|g| g[0] != g[1]));
+    /// assert!(picker.write_groups_to(2, &mut groups[..3]).is_err());
+    /// ```
+    pub fn write_groups_to(&mut self, amount: usize, dest: &mut [T]) -> Result<(), Error> {
+        self.check_groups(amount, dest.len())?;
+        if dest.is_empty() {
+            return Ok(()); // `amount` may be 0
+        }
+        for group in dest.chunks_exact_mut(amount) {
+            self.pick_indexes(amount)?;
+            for (k, &i) in group.iter_mut().zip(&self.picked_indexes) {
+                *k = self.item_key(i);
+            }
+        }
+        Ok(())
+    }
+
+    /// Does the same thing as `write_groups_to()`, but writes indexes of items
+    /// instead of cloning them. In repetitive mode, all groups are generated
+    /// as a whole. See `Picker::key()` for getting the item of an index.
+    ///
+    /// ```
+    /// let conf: random_picker::Config<String> = "
+    ///     repetitive = true; a=1; b=2; c=3
+    /// ".parse().unwrap();
+    /// let mut picker = random_picker::Picker::build(conf).unwrap();
+    /// let mut groups = vec![0; 4 * 1000];
+    /// picker.write_index_groups_to(4, &mut groups).unwrap();
+    /// assert!(groups.iter().all(|&i| i < picker.table_len()));
+    /// ```
+    pub fn write_index_groups_to(
+        &mut self,
+        amount: usize,
+        dest: &mut [usize],
+    ) -> Result<(), Error> {
+        self.check_groups(amount, dest.len())?;
+        if self.table.repetitive() || dest.is_empty() {
+            return self.fill_indexes(dest);
+        }
+        for group in dest.chunks_exact_mut(amount) {
+            self.pick_indexes(amount)?;
+            group.copy_from_slice(&self.picked_indexes);
+        }
+        Ok(())
+    }
+
     /// Evaluates probabilities of existences of table items in each group
     /// of length `amount`, by generating groups of items for `test_times`.
     ///
@@ -136,82 +473,488 @@ impl<T: Clone + Eq + Hash, R: RngCore> Picker<T, R> {
     /// }
     /// ```
     pub fn test_freqs(&mut self, amount: usize, test_times: usize) -> Result<Table<T>, Error> {
-        if test_times == 0 {
-            return Ok(self.table.iter().map(|(k, _)| (k.clone(), 0.)).collect());
+        let tbl_freq = self.count_freqs(amount, test_times)?;
+        Ok(self.freq_table(&tbl_freq, test_times))
+    }
+
+    /// Does the same thing as `test_freqs()` in `threads` worker threads
+    /// (0 means `std::thread::available_parallelism()`). Each worker has its own
+    /// copy of the sampling structures and its own random source returned by
+    /// `fork_rng`, which is called in the current thread with the random source
+    /// of this `Picker`; counts of all workers are merged at the end.
+    ///
+    /// ```
+    /// use rand::{rngs::StdRng, SeedableRng};
+    /// use random_picker::*;
+    /// let conf: Config<String> = "a=1;b=2;c=3;d=4;e=5".parse().unwrap();
+    /// let table_probs = conf.calc_probabilities(2).unwrap();
+    /// let mut picker = Picker::build(conf).unwrap();
+    /// let table_freqs = picker
+    ///     .test_freqs_parallel(2, 1_000_000, 4, |rng| {
+    ///         StdRng::from_rng(rng).map_err(Error::RandError)
+    ///     })
+    ///     .unwrap();
+    /// for (k, v) in table_freqs.iter() {
+    ///     assert!((*v - *table_probs.get(k).unwrap()).abs() < 0.005);
+    /// }
+    /// ```
+    pub fn test_freqs_parallel<W, F>(
+        &mut self,
+        amount: usize,
+        test_times: usize,
+        threads: usize,
+        mut fork_rng: F,
+    ) -> Result<Table<T>, Error>
+    where
+        T: Send + Sync,
+        W: RngCore + Send,
+        F: FnMut(&mut R) -> Result<W, Error>,
+    {
+        if !self.table.repetitive() && amount > self.table_len() {
+            return Err(Error::InvalidAmount);
         }
+        let threads = if threads > 0 {
+            threads
+        } else {
+            std::thread::available_parallelism()
+                .map(|n| n.get())
+                .unwrap_or(4)
+        };
+        let threads = threads.min(test_times.max(1));
+
+        let mut workers = Vec::with_capacity(threads);
+        for i in 0..threads {
+            let times = test_times / threads + usize::from(i < test_times % threads);
+            let rng = fork_rng(&mut self.rng)?;
+            workers.push((self.with_rng(rng), times));
+        }
+
+        let mut tbl_freq = vec![0_usize; self.table_len()];
+        std::thread::scope(|s| {
+            let thread_hdls: Vec<_> = (workers.into_iter())
+                .map(|(mut picker, times)| {
+                    s.spawn(move || {
+                        let sub_freq = picker.count_freqs(amount, times);
+                        sub_freq.map(|sub_freq| (sub_freq, picker.counters))
+                    })
+                })
+                .collect();
+            for hdl in thread_hdls {
+                let (sub_freq, counters) = hdl.join().map_err(|_| Error::ThreadError)??;
+                self.counters.add(&counters);
+                for (v, sub) in tbl_freq.iter_mut().zip(sub_freq) {
+                    *v += sub;
+                }
+            }
+            Ok(())
+        })?;
+        Ok(self.freq_table(&tbl_freq, test_times))
+    }
 
+    /// Does the same thing as `test_freqs()`, but returns frequencies in the order
+    /// of item indexes (see `Picker::key()`), without cloning any item.
+    pub fn test_index_freqs(
+        &mut self,
+        amount: usize,
+        test_times: usize,
+    ) -> Result<Vec<f64>, Error> {
+        let tbl_freq = self.count_freqs(amount, test_times)?;
+        let test_times = test_times.max(1) as f64;
+        Ok(tbl_freq.iter().map(|&v| v as f64 / test_times).collect())
+    }
+
+    /// Counts existences of table items in `test_times` groups of length `amount`.
+    pub(crate) fn count_freqs(
+        &mut self,
+        amount: usize,
+        test_times: usize,
+    ) -> Result<Vec<usize>, Error> {
         let mut tbl_freq = vec![0_usize; self.table_len()];
-        if !self.repetitive {
+        if !self.table.repetitive() {
             for _ in 0..test_times {
                 self.pick_indexes(amount)?;
                 for &idx in &self.picked_indexes {
                     tbl_freq[idx] += 1;
                 }
             }
+        } else if amount == 1 {
+            // each group is one draw, so draws of many groups are done at once
+            let mut indexes = vec![0; test_times.min(DRAW_BLOCK * 64)];
+            let mut remaining = test_times;
+            while remaining > 0 {
+                let cnt = remaining.min(indexes.len());
+                self.fill_indexes(&mut indexes[..cnt])?;
+                for &idx in &indexes[..cnt] {
+                    tbl_freq[idx] += 1;
+                }
+                remaining -= cnt;
+            }
         } else {
-            let mut tbl_picked = vec![false; self.table_len()];
+            let mut tbl_picked = BitSet::new(self.table_len());
             for _ in 0..test_times {
-                tbl_picked.fill(false);
+                tbl_picked.clear();
                 self.pick_indexes(amount)?;
                 for &idx in &self.picked_indexes {
-                    if !tbl_picked[idx] {
+                    if !tbl_picked.get(idx) {
                         tbl_freq[idx] += 1;
-                        tbl_picked[idx] = true;
+                        tbl_picked.set(idx);
                     }
                 }
             }
         }
+        Ok(tbl_freq)
+    }
 
+    pub(crate) fn freq_table(&self, tbl_freq: &[usize], test_times: usize) -> Table<T> {
+        if test_times == 0 {
+            return self.table.keys().iter().map(|k| (k.clone(), 0.)).collect();
+        }
         let test_times = test_times as f64;
-        let table = tbl_freq
+        tbl_freq
             .iter()
             .enumerate()
             .map(|(i, &v)| (self.item_key(i), v as f64 / test_times))
-            .collect();
-        Ok(table)
+            .collect()
+    }
+
+    /// Checks the group length and the destination length for batch operations.
+    #[inline(always)]
+    fn check_groups(&self, amount: usize, dest_len: usize) -> Result<(), Error> {
+        let valid_amount = self.table.repetitive() || amount <= self.table_len();
+        // `amount == 0` is valid only for empty destinations
+        // (`usize::is_multiple_of()` requires Rust 1.87)
+        let valid_len = dest_len
+            .checked_rem(amount)
+            .map_or(dest_len == 0, |r| r == 0);
+        (valid_amount && valid_len)
+            .then_some(())
+            .ok_or(Error::InvalidAmount)
+    }
+
+    /// Copies the configured sampling structures into a new `Picker` with another random source.
+    pub(crate) fn with_rng<W: RngCore>(&self, rng: W) -> Picker<T, W> {
+        Picker {
+            rng,
+            table: self.table.clone(),
+            grid_width: self.grid_width,
+            fenwick: self.fenwick.clone(),
+            method: self.method,
+            removal: self.removal.clone(),
+            removal_valid: self.removal_valid,
+            removal_ops: self.removal_ops,
+            key_indexes: HashMap::new(),
+            table_picked: self.table_picked.clone(),
+            picked_indexes: Vec::with_capacity(self.picked_indexes.capacity()),
+            counters: Counters::default(),
+        }
     }
 
     /// Picks `amount` of indexes and replaces values in `self.picked_indexes`.
+    ///
+    /// In non-repetitive mode, rejection sampling is done while the picked items
+    /// take less than half of the total weight, so each pick costs less than
+    /// 2 draws on average; then the remaining items are picked from a Fenwick tree
+    /// with weights of picked items removed, costing O(log n) for each pick.
+    /// Both ways follow the distribution of sequential picking without replacement.
     #[inline]
     fn pick_indexes(&mut self, amount: usize) -> Result<(), Error> {
-        if !self.repetitive && amount > self.table_len() {
+        if !self.table.repetitive() && amount > self.table_len() {
+            return Err(Error::InvalidAmount);
+        }
+        if self.table.repetitive() {
+            let mut picked_indexes = std::mem::take(&mut self.picked_indexes);
+            picked_indexes.resize(amount, 0);
+            let result = self.fill_indexes(&mut picked_indexes);
+            self.picked_indexes = picked_indexes;
+            return result;
+        }
+        self.pick_indexes_after(&[], amount)
+    }
+
+    /// Non-repetitive picking of `amount` items into `picked_indexes`, in which
+    /// the first items are `first` (distinct indexes given by the caller).
+    /// `amount` must not exceed the table length, otherwise `Error::InvalidAmount`
+    /// is returned (instead of looking for nonexistent items forever).
+    pub(crate) fn pick_indexes_after(
+        &mut self,
+        first: &[usize],
+        amount: usize,
+    ) -> Result<(), Error> {
+        if amount > self.table_len() {
             return Err(Error::InvalidAmount);
         }
+        self.prepare_sampler();
         self.picked_indexes.clear();
 
-        self.table_picked.fill(false);
-        while self.picked_indexes.len() < amount {
+        self.table_picked.clear();
+        let mut picked_width = 0.;
+        for &i in first {
+            self.table_picked.set(i);
+            picked_width += self.table.weights()[i];
+            self.picked_indexes.push(i);
+        }
+        while self.picked_indexes.len() < amount && picked_width * 2. < self.grid_width {
             let i = self.pick_index()?;
-            if !self.repetitive {
-                if self.table_picked[i] {
-                    continue;
+            if self.table_picked.get(i) {
+                self.counters.rejected_draw();
+                continue;
+            }
+            self.table_picked.set(i);
+            picked_width += self.table.weights()[i];
+            self.picked_indexes.push(i);
+        }
+        if self.picked_indexes.len() < amount {
+            self.pick_indexes_removal(amount)?;
+        }
+        Ok(())
+    }
+
+    /// Continues non-repetitive picking by removing picked weights from `self.removal`.
+    /// Weights are added back before returning, and the tree is rebuilt when
+    /// too many of these operations have been done (to avoid accumulated errors).
+    fn pick_indexes_removal(&mut self, amount: usize) -> Result<(), Error> {
+        if !self.removal_valid || self.removal_ops >= self.table_len() {
+            self.removal.rebuild(self.table.weights().iter().copied());
+            self.removal_valid = true;
+            self.removal_ops = 0;
+        }
+        for &i in &self.picked_indexes {
+            self.removal.add(i, -self.table.weights()[i]);
+        }
+
+        let mut result = Ok(());
+        let mut base_width = self.grid_width;
+        while self.picked_indexes.len() < amount {
+            let mut rem_width = self.removal.total();
+            if rem_width < base_width * 1e-6 {
+                // avoid cancellation errors: rebuild the tree without picked items
+                let table_picked = &self.table_picked;
+                let weights = (self.table.weights().iter().enumerate()).map(|(i, &v)| {
+                    if table_picked.get(i) {
+                        0.
+                    } else {
+                        v
+                    }
+                });
+                self.removal.rebuild(weights);
+                self.removal_ops = 0;
+                rem_width = self.removal.total();
+                base_width = rem_width;
+            }
+            let i = match self.rand_unit() {
+                Ok(val) => self.removal.search(val * rem_width),
+                Err(e) => {
+                    result = Err(e);
+                    break;
                 }
-                self.table_picked[i] = true;
+            };
+            self.counters.draws(1);
+            if self.table_picked.get(i) {
+                self.counters.rejected_draw();
+                continue; // caused by rounding errors, almost impossible
             }
+            self.table_picked.set(i);
+            self.removal.add(i, -self.table.weights()[i]);
             self.picked_indexes.push(i);
         }
+
+        for &i in &self.picked_indexes {
+            self.removal.add(i, self.table.weights()[i]);
+        }
+        self.removal_ops += self.picked_indexes.len();
+        result
+    }
+
+    /// Draws `dest.len()` indexes independently. For the alias method, random bytes
+    /// are requested in blocks of `DRAW_BLOCK` draws.
+    #[inline]
+    fn fill_indexes(&mut self, dest: &mut [usize]) -> Result<(), Error> {
+        self.prepare_sampler();
+        let sample: fn(&CompiledTable<T>, u64) -> usize = match self.method {
+            PickMethod::Alias => |table, bits| table.alias().sample(bits),
+            PickMethod::Fixed => |table, bits| search::search_fixed(table.fixed(), bits >> 2),
+            _ => {
+                for i in dest.iter_mut() {
+                    *i = self.pick_index()?;
+                }
+                return Ok(());
+            }
+        };
+        let mut bytes = [0u8; 8 * DRAW_BLOCK];
+        for chunk in dest.chunks_mut(DRAW_BLOCK) {
+            let bytes = &mut bytes[..8 * chunk.len()];
+            self.rng.try_fill_bytes(bytes).map_err(Error::RandError)?;
+            self.counters.rng_fill(bytes.len());
+            for (i, b) in chunk.iter_mut().zip(bytes.chunks_exact(8)) {
+                *i = sample(&self.table, u64::from_ne_bytes(b.try_into().unwrap()));
+            }
+            self.counters.draws(chunk.len());
+            if self.method == PickMethod::Fixed {
+                self.counters.grid_searches(self.table_len(), chunk.len());
+            }
+        }
         Ok(())
     }
 
     #[inline(always)]
     fn pick_index(&mut self) -> Result<usize, Error> {
+        self.counters.draws(1);
+        match self.method {
+            PickMethod::Alias => {
+                let mut bytes = [0u8; 8];
+                self.rng
+                    .try_fill_bytes(&mut bytes)
+                    .map_err(Error::RandError)?;
+                self.counters.rng_fill(bytes.len());
+                Ok(self.table.alias().sample(u64::from_ne_bytes(bytes)))
+            }
+            PickMethod::Grid => self.pick_index_grid(),
+            PickMethod::Fixed => {
+                let mut bytes = [0u8; 8];
+                self.rng
+                    .try_fill_bytes(&mut bytes)
+                    .map_err(Error::RandError)?;
+                self.counters.rng_fill(bytes.len());
+                self.counters.grid_searches(self.table_len(), 1);
+                // multiply-shift by FIXED_TOTAL (2^62), no rejection is needed
+                let val = u64::from_ne_bytes(bytes) >> 2;
+                Ok(search::search_fixed(self.table.fixed(), val))
+            }
+            PickMethod::Tree => {
+                let val = self.rand_unit()? * self.grid_width;
+                Ok(self.fenwick.search(val))
+            }
+        }
+    }
+
+    /// Returns a random value within (0, 1] with 53-bit resolution.
+    #[inline(always)]
+    fn rand_unit(&mut self) -> Result<f64, Error> {
+        let mut bytes = [0u8; 8];
+        self.rng
+            .try_fill_bytes(&mut bytes)
+            .map_err(Error::RandError)?;
+        self.counters.rng_fill(bytes.len());
+        Ok(((u64::from_ne_bytes(bytes) >> 11) + 1) as f64 * (1. / (1u64 << 53) as f64))
+    }
+
+    #[inline(always)]
+    fn pick_index_grid(&mut self) -> Result<usize, Error> {
         let mut bytes = [0u8; 4];
         self.rng
             .try_fill_bytes(&mut bytes)
             .map_err(Error::RandError)?;
+        self.counters.rng_fill(bytes.len());
+        self.counters.grid_searches(self.table_len(), 1);
 
         let val = (u32::from_ne_bytes(bytes) as f64) / (u32::MAX as f64) * self.grid_width;
-        for (i, &v) in self.grid.iter().enumerate() {
-            if val <= v {
-                return Ok(i);
-            };
+        // the first index `i` that satisfies `val <= grid[i]`
+        let i = search::search_grid(self.table.grid(), val);
+        Ok(i.min(self.table_len() - 1)) // exceeding is almost impossible
+    }
+
+    /// Checks a weight value in `Config::table`, and does the inversion if it is needed.
+    #[inline(always)]
+    fn compiled_weight(&self, weight: f64) -> Result<f64, Error> {
+        let weight = if self.table.inversed() {
+            1. / weight
+        } else {
+            weight
+        };
+        if weight > 0. && weight.is_finite() {
+            Ok(weight)
+        } else {
+            Err(Error::InvalidTable)
+        }
+    }
+
+    #[inline(always)]
+    fn update_grid_width(&mut self) {
+        self.grid_width = if self.method == PickMethod::Tree {
+            self.fenwick.total()
+        } else {
+            self.table.total_weight()
+        };
+    }
+
+    /// Rebuilds the sampling structure invalidated by modifications of the table.
+    #[inline(always)]
+    pub(crate) fn prepare_sampler(&mut self) {
+        if !self.table.is_prepared(self.method) {
+            self.rebuild_sampler();
+        }
+    }
+
+    /// Builds the sampling structure required by the current method.
+    fn rebuild_sampler(&mut self) {
+        let timer = Counters::timer();
+        if self.method == PickMethod::Tree {
+            self.fenwick.rebuild(self.table.weights().iter().copied());
+            self.grid_width = self.fenwick.total();
+        } else {
+            if !self.table.is_prepared(self.method) {
+                Arc::make_mut(&mut self.table).prepare(self.method);
+            }
+            self.grid_width = self.table.total_weight();
         }
+        self.counters.rebuilt(timer);
+    }
 
-        Ok(self.table_len() - 1) // almost impossible
+    #[inline(always)]
+    pub(crate) fn rng_mut(&mut self) -> &mut R {
+        &mut self.rng
+    }
+
+    #[inline(always)]
+    pub(crate) fn picked_indexes(&self) -> &[usize] {
+        &self.picked_indexes
     }
 
     #[inline(always)]
     fn item_key(&self, i: usize) -> T {
-        self.table[i].0.clone()
+        self.table.keys()[i].clone()
+    }
+}
+
+impl<R: RngCore> Picker<String, R> {
+    /// Applies the configuration input string to the live picker, like
+    /// `Config::append_str()` followed by `configure()`, but only the affected
+    /// items are modified by `insert()` and `remove()`. Changing `inversed`
+    /// inverts all weights in O(n). It stops at the first invalid modification,
+    /// for example, deleting the only item.
+    ///
+    /// ```
+    /// let conf: random_picker::Config<String> = "a=1;b=2;c=3".parse().unwrap();
+    /// let mut picker = random_picker::Picker::build(conf).unwrap();
+    /// picker.update_str("delete a; d = 4\nb = 0; repetitive = true").unwrap();
+    /// let mut keys = picker.keys().to_vec();
+    /// keys.sort();
+    /// assert_eq!(keys, ["c", "d"]);
+    /// assert_eq!(picker.pick(3).unwrap().len(), 3);
+    /// assert!(picker.update_str("delete c; delete d").is_err());
+    /// ```
+    pub fn update_str(&mut self, str_items: &str) -> Result<(), Error> {
+        for line in str_items.split(&['\r', '\n', ';']) {
+            match ConfLine::parse(line) {
+                Some(ConfLine::Item(item_name, v)) => self.insert(item_name.to_string(), v)?,
+                Some(ConfLine::Delete(item_name)) => {
+                    self.remove(&item_name.to_string())?;
+                }
+                Some(ConfLine::Repetitive(b)) => {
+                    if b != self.table.repetitive() {
+                        Arc::make_mut(&mut self.table).set_repetitive(b);
+                    }
+                }
+                Some(ConfLine::Inversed(b)) => {
+                    if b != self.table.inversed() {
+                        Arc::make_mut(&mut self.table).invert();
+                        self.removal_valid = false;
+                        self.rebuild_sampler();
+                    }
+                }
+                None => (),
+            }
+        }
+        Ok(())
     }
 }
@@ -0,0 +1,542 @@
+//! Random sources that can be used by `Picker::build_with_rng()`.
+//!
+//! Besides `BufferedRng` for the OS random source, fast pseudo random generators
+//! are provided. Each of them has `split()`, which returns a generator continuing
+//! the current sequence and moves the generator itself to a sequence that doesn't
+//! overlap with it; it can be used as `fork_rng` of `Picker::test_freqs_parallel()`.
+//!
+//! | Generator                | Speed   | State  | `split()`        | Use case                              |
+//! |--------------------------|---------|--------|------------------|---------------------------------------|
+//! | `BufferedRng<OsRng>`     | slow    | 16 KiB | -                | real drawings, unpredictable          |
+//! | `rand::rngs::ThreadRng`  | medium  | -      | -                | general purpose, not `Send`           |
+//! | `ChaCha8Rng`             | medium  | 312 B  | next stream      | simulations requiring better mixing   |
+//! | `Pcg64`                  | fast    | 32 B   | advance by 2^64  | simulations, tests                    |
+//! | `Xoshiro256PlusPlus`     | fastest | 32 B   | jump by 2^128    | simulations, tests                    |
+//!
+//! None of the pseudo random generators here is suitable for cryptographic purposes.
+
+use rand::{CryptoRng, Error, RngCore, SeedableRng};
+
+/// Wrapper of a random source (usually `OsRng`), which fills a large block
+/// of bytes with each request to the inner source, and serves draws from it.
+/// Each byte from the inner source is served only once, so it is as good as
+/// the inner source; it just avoids one system call for each draw.
+///
+/// ```
+/// use random_picker::{rngs::BufferedRng, Picker};
+/// let conf: random_picker::Config<String> = "a=1;b=2;c=3".parse().unwrap();
+/// let rng = BufferedRng::new(rand::rngs::OsRng);
+/// let mut picker = Picker::build_with_rng(conf, rng).unwrap();
+/// assert_eq!(picker.pick(2).unwrap().len(), 2);
+///
+/// // a clone does not share buffered bytes
+/// use rand::RngCore;
+/// let mut rng = BufferedRng::new(rand::rngs::OsRng);
+/// rng.next_u64();
+/// let mut rng_clone = rng.clone();
+/// assert_ne!(rng.next_u64(), rng_clone.next_u64());
+/// ```
+#[derive(Debug)]
+pub struct BufferedRng<R: RngCore> {
+    rng: R,
+    buf: Box<[u8]>,
+    pos: usize, // bytes before `pos` are consumed
+}
+
+impl<R: RngCore> BufferedRng<R> {
+    /// Default size of the buffer: 16 KiB.
+    pub const DEFAULT_CAPACITY: usize = 16 * 1024;
+
+    /// Wraps `rng` with a buffer of `DEFAULT_CAPACITY`.
+    #[inline(always)]
+    pub fn new(rng: R) -> Self {
+        Self::with_capacity(rng, Self::DEFAULT_CAPACITY)
+    }
+
+    /// Wraps `rng` with a buffer of `capacity` bytes (at least 8 bytes).
+    pub fn with_capacity(rng: R, capacity: usize) -> Self {
+        let capacity = capacity.max(8);
+        Self {
+            rng,
+            buf: vec![0u8; capacity].into_boxed_slice(),
+            pos: capacity, // empty
+        }
+    }
+
+    /// Returns the inner random source, discarding buffered bytes.
+    #[inline(always)]
+    pub fn into_inner(self) -> R {
+        self.rng
+    }
+
+    #[inline(always)]
+    fn refill(&mut self) -> Result<(), Error> {
+        self.rng.try_fill_bytes(&mut self.buf)?;
+        self.pos = 0;
+        Ok(())
+    }
+}
+
+/// The clone starts with an empty buffer, so that buffered bytes are never served twice.
+impl<R: RngCore + Clone> Clone for BufferedRng<R> {
+    fn clone(&self) -> Self {
+        Self::with_capacity(self.rng.clone(), self.buf.len())
+    }
+}
+
+impl<R: RngCore> RngCore for BufferedRng<R> {
+    #[inline(always)]
+    fn next_u32(&mut self) -> u32 {
+        let mut bytes = [0u8; 4];
+        self.fill_bytes(&mut bytes);
+        u32::from_ne_bytes(bytes)
+    }
+
+    #[inline(always)]
+    fn next_u64(&mut self) -> u64 {
+        let mut bytes = [0u8; 8];
+        self.fill_bytes(&mut bytes);
+        u64::from_ne_bytes(bytes)
+    }
+
+    #[inline(always)]
+    fn fill_bytes(&mut self, dest: &mut [u8]) {
+        if let Err(e) = self.try_fill_bytes(dest) {
+            panic!("Error: {e}");
+        }
+    }
+
+    #[inline]
+    fn try_fill_bytes(&mut self, dest: &mut [u8]) -> Result<(), Error> {
+        let avail = self.buf.len() - self.pos;
+        if dest.len() <= avail {
+            dest.copy_from_slice(&self.buf[self.pos..self.pos + dest.len()]);
+            self.pos += dest.len();
+            return Ok(());
+        }
+        if dest.len() >= self.buf.len() {
+            // large request: the buffer makes no sense
+            return self.rng.try_fill_bytes(dest);
+        }
+        let (dest_a, dest_b) = dest.split_at_mut(avail);
+        dest_a.copy_from_slice(&self.buf[self.pos..]);
+        self.pos = self.buf.len();
+        self.refill()?;
+        dest_b.copy_from_slice(&self.buf[..dest_b.len()]);
+        self.pos = dest_b.len();
+        Ok(())
+    }
+}
+
+impl<R: RngCore + CryptoRng> CryptoRng for BufferedRng<R> {}
+
+/// Xoshiro256++ by David Blackman and Sebastiano Vigna, with a period of 2^256 - 1.
+///
+/// ```
+/// use rand::SeedableRng;
+/// use random_picker::{rngs::Xoshiro256PlusPlus, Picker};
+/// let conf: random_picker::Config<String> = "a=1;b=2;c=3".parse().unwrap();
+/// let rng = Xoshiro256PlusPlus::seed_from_u64(1);
+/// let mut picker = Picker::build_with_rng(conf, rng).unwrap();
+/// let _ = picker
+///     .test_freqs_parallel(2, 10_000, 4, |rng| Ok(rng.split()))
+///     .unwrap();
+/// ```
+#[derive(Clone, Debug, PartialEq, Eq)]
+pub struct Xoshiro256PlusPlus {
+    s: [u64; 4],
+}
+
+impl Xoshiro256PlusPlus {
+    /// Advances the generator by 2^128 steps.
+    pub fn jump(&mut self) {
+        const JUMP: [u64; 4] = [
+            0x180e_c6d3_3cfd_0aba,
+            0xd5a6_1266_f0c9_392c,
+            0xa958_2618_e03f_c9aa,
+            0x39ab_dc45_29b1_661c,
+        ];
+        let mut s = [0u64; 4];
+        for j in JUMP {
+            for b in 0..64 {
+                if (j >> b) & 1 != 0 {
+                    for (v, cur) in s.iter_mut().zip(self.s) {
+                        *v ^= cur;
+                    }
+                }
+                self.next_u64();
+            }
+        }
+        self.s = s;
+    }
+
+    /// Returns a copy of the generator, then calls `jump()`.
+    #[inline]
+    pub fn split(&mut self) -> Self {
+        let rng = self.clone();
+        self.jump();
+        rng
+    }
+}
+
+impl RngCore for Xoshiro256PlusPlus {
+    #[inline(always)]
+    fn next_u32(&mut self) -> u32 {
+        (self.next_u64() >> 32) as u32
+    }
+
+    #[inline(always)]
+    fn next_u64(&mut self) -> u64 {
+        let s = &mut self.s;
+        let result = s[0].wrapping_add(s[3]).rotate_left(23).wrapping_add(s[0]);
+        let t = s[1] << 17;
+        s[2] ^= s[0];
+        s[3] ^= s[1];
+        s[1] ^= s[2];
+        s[0] ^= s[3];
+        s[2] ^= t;
+        s[3] = s[3].rotate_left(45);
+        result
+    }
+
+    #[inline]
+    fn fill_bytes(&mut self, dest: &mut [u8]) {
+        fill_bytes_via_u64(self, dest);
+    }
+
+    #[inline(always)]
+    fn try_fill_bytes(&mut self, dest: &mut [u8]) -> Result<(), Error> {
+        self.fill_bytes(dest);
+        Ok(())
+    }
+}
+
+impl SeedableRng for Xoshiro256PlusPlus {
+    type Seed = [u8; 32];
+
+    /// The all-zero seed is replaced by `seed_from_u64(0)`, because
+    /// the all-zero state is not allowed.
+    fn from_seed(seed: [u8; 32]) -> Self {
+        if seed == [0; 32] {
+            return Self::seed_from_u64(0);
+        }
+        let mut s = [0u64; 4];
+        for (v, b) in s.iter_mut().zip(seed.chunks_exact(8)) {
+            *v = u64::from_le_bytes(b.try_into().unwrap());
+        }
+        Self { s }
+    }
+}
+
+/// PCG XSL RR 128/64 (also known as PCG64) by Melissa O'Neill, with a period of 2^128.
+#[derive(Clone, Debug, PartialEq, Eq)]
+pub struct Pcg64 {
+    state: u128,
+    increment: u128,
+}
+
+impl Pcg64 {
+    const MULTIPLIER: u128 = 0x2360_ed05_1fc6_5da4_4385_df64_9fcc_f645;
+
+    /// Creates the generator from the initial state and the stream number.
+    /// Generators of different streams produce different sequences.
+    pub fn new(state: u128, stream: u128) -> Self {
+        Self::from_state_incr(state, (stream << 1) | 1)
+    }
+
+    fn from_state_incr(state: u128, increment: u128) -> Self {
+        let mut rng = Self { state, increment };
+        rng.state = rng.state.wrapping_add(rng.increment);
+        rng.step();
+        rng
+    }
+
+    /// Advances the generator by `delta` steps in O(log delta) time.
+    pub fn advance(&mut self, delta: u128) {
+        let (mut acc_mult, mut acc_plus) = (1u128, 0u128);
+        let (mut cur_mult, mut cur_plus) = (Self::MULTIPLIER, self.increment);
+        let mut delta = delta;
+        while delta > 0 {
+            if delta & 1 != 0 {
+                acc_mult = acc_mult.wrapping_mul(cur_mult);
+                acc_plus = acc_plus.wrapping_mul(cur_mult).wrapping_add(cur_plus);
+            }
+            cur_plus = cur_mult.wrapping_add(1).wrapping_mul(cur_plus);
+            cur_mult = cur_mult.wrapping_mul(cur_mult);
+            delta >>= 1;
+        }
+        self.state = acc_mult.wrapping_mul(self.state).wrapping_add(acc_plus);
+    }
+
+    /// Returns a copy of the generator, then advances it by 2^64 steps.
+    #[inline]
+    pub fn split(&mut self) -> Self {
+        let rng = self.clone();
+        self.advance(1 << 64);
+        rng
+    }
+
+    #[inline(always)]
+    fn step(&mut self) {
+        self.state = self
+            .state
+            .wrapping_mul(Self::MULTIPLIER)
+            .wrapping_add(self.increment);
+    }
+}
+
+impl RngCore for Pcg64 {
+    #[inline(always)]
+    fn next_u32(&mut self) -> u32 {
+        self.next_u64() as u32
+    }
+
+    #[inline(always)]
+    fn next_u64(&mut self) -> u64 {
+        self.step();
+        let state = self.state;
+        let rot = (state >> 122) as u32;
+        let xsl = ((state >> 64) as u64) ^ (state as u64);
+        xsl.rotate_right(rot)
+    }
+
+    #[inline]
+    fn fill_bytes(&mut self, dest: &mut [u8]) {
+        fill_bytes_via_u64(self, dest);
+    }
+
+    #[inline(always)]
+    fn try_fill_bytes(&mut self, dest: &mut [u8]) -> Result<(), Error> {
+        self.fill_bytes(dest);
+        Ok(())
+    }
+}
+
+impl SeedableRng for Pcg64 {
+    /// The initial state and the increment in little-endian order.
+    type Seed = [u8; 32];
+
+    fn from_seed(seed: [u8; 32]) -> Self {
+        let state = u128::from_le_bytes(seed[..16].try_into().unwrap());
+        let increment = u128::from_le_bytes(seed[16..].try_into().unwrap());
+        Self::from_state_incr(state, increment | 1)
+    }
+}
+
+/// ChaCha stream cipher by Daniel J. Bernstein reduced to 8 rounds, used as
+/// a random generator: the seed is the key, each stream has 2^64 blocks of 64 bytes.
+/// 4 blocks are generated at once, so that the compiler is able to vectorize it.
+#[derive(Clone, Debug, PartialEq, Eq)]
+pub struct ChaCha8Rng {
+    key: [u32; 8],
+    counter: u64, // next block
+    stream: u64,
+    buf: [u32; 16 * CHACHA_BLOCKS],
+    index: usize, // words before `index` are consumed
+}
+
+const CHACHA_BLOCKS: usize = 4;
+type Lanes = [u32; CHACHA_BLOCKS]; // one word of each block
+
+impl ChaCha8Rng {
+    const ROUNDS: usize = 8;
+
+    /// Returns the stream number.
+    #[inline(always)]
+    pub fn stream(&self) -> u64 {
+        self.stream
+    }
+
+    /// Switches to the stream `stream` after blocks that have been generated,
+    /// discarding buffered values.
+    #[inline]
+    pub fn set_stream(&mut self, stream: u64) {
+        self.stream = stream;
+        self.index = self.buf.len();
+    }
+
+    /// Returns a copy of the generator, then switches to the next stream.
+    #[inline]
+    pub fn split(&mut self) -> Self {
+        let rng = self.clone();
+        self.set_stream(self.stream.wrapping_add(1));
+        rng
+    }
+
+    fn refill(&mut self) {
+        const CONSTANTS: [u32; 4] = [0x6170_7865, 0x3320_646e, 0x7962_2d32, 0x6b20_6574];
+        let mut input = [[0u32; CHACHA_BLOCKS]; 16];
+        for (w, lanes) in input.iter_mut().enumerate() {
+            *lanes = match w {
+                0..4 => [CONSTANTS[w]; CHACHA_BLOCKS],
+                4..12 => [self.key[w - 4]; CHACHA_BLOCKS],
+                12 | 13 => std::array::from_fn(|l| {
+                    let counter = self.counter.wrapping_add(l as u64);
+                    (counter >> (32 * (w - 12))) as u32
+                }),
+                _ => [(self.stream >> (32 * (w - 14))) as u32; CHACHA_BLOCKS],
+            };
+        }
+
+        let mut x = input;
+        double_rounds(&mut x, Self::ROUNDS / 2);
+        for (w, (lanes, lanes_in)) in x.iter().zip(input).enumerate() {
+            for l in 0..CHACHA_BLOCKS {
+                self.buf[l * 16 + w] = lanes[l].wrapping_add(lanes_in[l]);
+            }
+        }
+        self.counter = self.counter.wrapping_add(CHACHA_BLOCKS as u64);
+        self.index = 0;
+    }
+}
+
+#[cfg(not(target_arch = "x86_64"))]
+fn double_rounds(x: &mut [Lanes; 16], cnt: usize) {
+    for _ in 0..cnt {
+        quarter_round(x, 0, 4, 8, 12);
+        quarter_round(x, 1, 5, 9, 13);
+        quarter_round(x, 2, 6, 10, 14);
+        quarter_round(x, 3, 7, 11, 15);
+        quarter_round(x, 0, 5, 10, 15);
+        quarter_round(x, 1, 6, 11, 12);
+        quarter_round(x, 2, 7, 8, 13);
+        quarter_round(x, 3, 4, 9, 14);
+    }
+}
+
+/// SSE2 is always available on x86_64: each register holds one word of 4 blocks.
+#[cfg(target_arch = "x86_64")]
+fn double_rounds(x: &mut [Lanes; 16], cnt: usize) {
+    use std::arch::x86_64::*;
+    macro_rules! rotate_left {
+        ($v:expr, $r:literal) => {
+            _mm_or_si128(_mm_slli_epi32::<$r>($v), _mm_srli_epi32::<{ 32 - $r }>($v))
+        };
+    }
+    macro_rules! quarter_round {
+        ($v:ident, $a:literal, $b:literal, $c:literal, $d:literal) => {
+            $v[$a] = _mm_add_epi32($v[$a], $v[$b]);
+            $v[$d] = rotate_left!(_mm_xor_si128($v[$d], $v[$a]), 16);
+            $v[$c] = _mm_add_epi32($v[$c], $v[$d]);
+            $v[$b] = rotate_left!(_mm_xor_si128($v[$b], $v[$c]), 12);
+            $v[$a] = _mm_add_epi32($v[$a], $v[$b]);
+            $v[$d] = rotate_left!(_mm_xor_si128($v[$d], $v[$a]), 8);
+            $v[$c] = _mm_add_epi32($v[$c], $v[$d]);
+            $v[$b] = rotate_left!(_mm_xor_si128($v[$b], $v[$c]), 7);
+        };
+    }
+    unsafe {
+        let mut v: [__m128i; 16] =
+            std::array::from_fn(|w| _mm_loadu_si128(x[w].as_ptr() as *const __m128i));
+        for _ in 0..cnt {
+            quarter_round!(v, 0, 4, 8, 12);
+            quarter_round!(v, 1, 5, 9, 13);
+            quarter_round!(v, 2, 6, 10, 14);
+            quarter_round!(v, 3, 7, 11, 15);
+            quarter_round!(v, 0, 5, 10, 15);
+            quarter_round!(v, 1, 6, 11, 12);
+            quarter_round!(v, 2, 7, 8, 13);
+            quarter_round!(v, 3, 4, 9, 14);
+        }
+        for (lanes, v) in x.iter_mut().zip(v) {
+            _mm_storeu_si128(lanes.as_mut_ptr() as *mut __m128i, v);
+        }
+    }
+}
+
+#[cfg(not(target_arch = "x86_64"))]
+#[inline(always)]
+fn quarter_round(x: &mut [Lanes; 16], a: usize, b: usize, c: usize, d: usize) {
+    #[inline(always)]
+    fn add_xor_rotate(x: &mut [Lanes; 16], a: usize, b: usize, d: usize, rot: u32) {
+        let (mut va, vb, mut vd) = (x[a], x[b], x[d]);
+        for l in 0..CHACHA_BLOCKS {
+            va[l] = va[l].wrapping_add(vb[l]);
+            vd[l] = (vd[l] ^ va[l]).rotate_left(rot);
+        }
+        (x[a], x[d]) = (va, vd);
+    }
+    add_xor_rotate(x, a, b, d, 16);
+    add_xor_rotate(x, c, d, b, 12);
+    add_xor_rotate(x, a, b, d, 8);
+    add_xor_rotate(x, c, d, b, 7);
+}
+
+impl RngCore for ChaCha8Rng {
+    #[inline(always)]
+    fn next_u32(&mut self) -> u32 {
+        if self.index >= self.buf.len() {
+            self.refill();
+        }
+        self.index += 1;
+        self.buf[self.index - 1]
+    }
+
+    #[inline(always)]
+    fn next_u64(&mut self) -> u64 {
+        let lo = self.next_u32() as u64;
+        (self.next_u32() as u64) << 32 | lo
+    }
+
+    #[inline]
+    fn fill_bytes(&mut self, dest: &mut [u8]) {
+        let mut dest = dest;
+        while !dest.is_empty() {
+            if self.index >= self.buf.len() {
+                self.refill();
+            }
+            let words = &self.buf[self.index..];
+            if dest.len() < 4 {
+                let len = dest.len();
+                dest.copy_from_slice(&words[0].to_le_bytes()[..len]);
+                self.index += 1;
+                return;
+            }
+            let cnt_words = (dest.len() / 4).min(words.len());
+            let (dest_a, dest_b) = dest.split_at_mut(4 * cnt_words);
+            for (d, w) in dest_a.chunks_exact_mut(4).zip(words) {
+                d.copy_from_slice(&w.to_le_bytes());
+            }
+            self.index += cnt_words;
+            dest = dest_b;
+        }
+    }
+
+    #[inline(always)]
+    fn try_fill_bytes(&mut self, dest: &mut [u8]) -> Result<(), Error> {
+        self.fill_bytes(dest);
+        Ok(())
+    }
+}
+
+impl SeedableRng for ChaCha8Rng {
+    /// The key of the cipher; the stream is 0.
+    type Seed = [u8; 32];
+
+    fn from_seed(seed: [u8; 32]) -> Self {
+        let mut key = [0u32; 8];
+        for (k, b) in key.iter_mut().zip(seed.chunks_exact(4)) {
+            *k = u32::from_le_bytes(b.try_into().unwrap());
+        }
+        Self {
+            key,
+            counter: 0,
+            stream: 0,
+            buf: [0; 16 * CHACHA_BLOCKS],
+            index: 16 * CHACHA_BLOCKS, // empty
+        }
+    }
+}
+
+#[inline(always)]
+fn fill_bytes_via_u64<R: RngCore>(rng: &mut R, dest: &mut [u8]) {
+    let mut chunks = dest.chunks_exact_mut(8);
+    for chunk in &mut chunks {
+        chunk.copy_from_slice(&rng.next_u64().to_le_bytes());
+    }
+    let rem = chunks.into_remainder();
+    if !rem.is_empty() {
+        let len = rem.len();
+        rem.copy_from_slice(&rng.next_u64().to_le_bytes()[..len]);
+    }
+}
@@ -0,0 +1,127 @@
+//! Search kernels for cumulative grids of `PickMethod::Grid` and `PickMethod::Fixed`.
+
+/// Grids not longer than this are searched by counting values less than the
+/// target with SIMD comparisons, which has no branch depending on the data;
+/// longer grids are searched by binary search (`partition_point()`).
+pub(crate) const SIMD_MAX_LEN: usize = 64;
+
+/// Returns the first index `i` that satisfies `val <= grid[i]`, or `grid.len()`
+/// if there is no such index. `grid` must be in ascending order.
+#[inline]
+pub(crate) fn search_grid(grid: &[f64], val: f64) -> usize {
+    if grid.len() <= SIMD_MAX_LEN {
+        #[cfg(target_arch = "x86_64")]
+        if std::is_x86_feature_detected!("avx2") {
+            return unsafe { count_less_avx2(grid, val) };
+        }
+        #[cfg(target_arch = "aarch64")]
+        return unsafe { count_less_neon(grid, val) }; // NEON is always available
+    }
+    search_scalar(grid, val)
+}
+
+/// Amount of grid entries compared by `search_grid()` or `search_fixed()` for
+/// a grid of length `len`: all of them if SIMD counting is used, otherwise
+/// the amount of steps of binary search.
+#[cfg(feature = "stats")]
+pub(crate) fn scan_len(len: usize) -> usize {
+    let simd = len <= SIMD_MAX_LEN && {
+        #[cfg(target_arch = "x86_64")]
+        let simd = std::is_x86_feature_detected!("avx2");
+        #[cfg(target_arch = "aarch64")]
+        let simd = true;
+        #[cfg(not(any(target_arch = "x86_64", target_arch = "aarch64")))]
+        let simd = false;
+        simd
+    };
+    if simd {
+        len
+    } else {
+        (usize::BITS - len.leading_zeros()) as usize
+    }
+}
+
+/// Scalar fallback of `search_grid()`.
+#[inline(always)]
+pub(crate) fn search_scalar(grid: &[f64], val: f64) -> usize {
+    grid.partition_point(|&v| v < val)
+}
+
+/// Returns the first index `i` that satisfies `val < grid[i]`, in which `grid` is
+/// the cumulative grid of quantized weights (not exceeding `FIXED_TOTAL`, 2^62)
+/// and `val` is less than the last value.
+#[inline]
+pub(crate) fn search_fixed(grid: &[u64], val: u64) -> usize {
+    if grid.len() <= SIMD_MAX_LEN {
+        #[cfg(target_arch = "x86_64")]
+        if std::is_x86_feature_detected!("avx2") {
+            return unsafe { count_not_greater_avx2(grid, val) };
+        }
+        #[cfg(target_arch = "aarch64")]
+        return unsafe { count_not_greater_neon(grid, val) };
+    }
+    grid.partition_point(|&v| v <= val)
+}
+
+#[cfg(target_arch = "x86_64")]
+#[target_feature(enable = "avx2")]
+unsafe fn count_less_avx2(grid: &[f64], val: f64) -> usize {
+    use std::arch::x86_64::*;
+    let v = _mm256_set1_pd(val);
+    let chunks = grid.chunks_exact(4);
+    let rem = chunks.remainder();
+    // each lane of the comparison result is 0 or u64::MAX (that is, -1)
+    let mut cnt = _mm256_setzero_si256();
+    for chunk in chunks {
+        let lt = _mm256_cmp_pd::<_CMP_LT_OQ>(_mm256_loadu_pd(chunk.as_ptr()), v);
+        cnt = _mm256_sub_epi64(cnt, _mm256_castpd_si256(lt));
+    }
+    let mut lanes = [0u64; 4];
+    _mm256_storeu_si256(lanes.as_mut_ptr() as *mut __m256i, cnt);
+    lanes.iter().sum::<u64>() as usize + rem.iter().filter(|&&g| g < val).count()
+}
+
+#[cfg(target_arch = "aarch64")]
+unsafe fn count_less_neon(grid: &[f64], val: f64) -> usize {
+    use std::arch::aarch64::*;
+    let v = vdupq_n_f64(val);
+    let chunks = grid.chunks_exact(2);
+    let rem = chunks.remainder();
+    let mut cnt = vdupq_n_u64(0);
+    for chunk in chunks {
+        cnt = vsubq_u64(cnt, vcltq_f64(vld1q_f64(chunk.as_ptr()), v));
+    }
+    vaddvq_u64(cnt) as usize + rem.iter().filter(|&&g| g < val).count()
+}
+
+#[cfg(target_arch = "x86_64")]
+#[target_feature(enable = "avx2")]
+unsafe fn count_not_greater_avx2(grid: &[u64], val: u64) -> usize {
+    use std::arch::x86_64::*;
+    // the comparison is signed, which is correct for values less than 2^63
+    let v = _mm256_set1_epi64x(val as i64);
+    let chunks = grid.chunks_exact(4);
+    let rem = chunks.remainder();
+    let mut cnt_gt = _mm256_setzero_si256();
+    for chunk in chunks {
+        let g = _mm256_loadu_si256(chunk.as_ptr() as *const __m256i);
+        cnt_gt = _mm256_sub_epi64(cnt_gt, _mm256_cmpgt_epi64(g, v));
+    }
+    let mut lanes = [0u64; 4];
+    _mm256_storeu_si256(lanes.as_mut_ptr() as *mut __m256i, cnt_gt);
+    let cnt_gt = lanes.iter().sum::<u64>() as usize;
+    (grid.len() - rem.len() - cnt_gt) + rem.iter().filter(|&&g| g <= val).count()
+}
+
+#[cfg(target_arch = "aarch64")]
+unsafe fn count_not_greater_neon(grid: &[u64], val: u64) -> usize {
+    use std::arch::aarch64::*;
+    let v = vdupq_n_u64(val);
+    let chunks = grid.chunks_exact(2);
+    let rem = chunks.remainder();
+    let mut cnt = vdupq_n_u64(0);
+    for chunk in chunks {
+        cnt = vsubq_u64(cnt, vcleq_u64(vld1q_u64(chunk.as_ptr()), v));
+    }
+    vaddvq_u64(cnt) as usize + rem.iter().filter(|&&g| g <= val).count()
+}
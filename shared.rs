@@ -0,0 +1,189 @@
+use crate::*;
+use rand::RngCore;
+use std::{
+    hash::Hash,
+    sync::{
+        atomic::{AtomicU64, Ordering},
+        Arc, Mutex,
+    },
+};
+
+/// Compiled table shared by `SharedPicker`s in many threads, which can be
+/// replaced while they are picking. A new table is built by the caller, then
+/// `publish()` swaps the `Arc` under a mutex and increases the generation
+/// counter; each `SharedPicker` checks the counter with one atomic load before
+/// picking, and takes the mutex for cloning the `Arc` once after each
+/// generation change. So readers are not wait-free: right after a publication,
+/// they may wait briefly for each other and for the writer. Picks in progress
+/// keep using the old table, which is dropped when the last `SharedPicker`
+/// moves to the new one.
+///
+/// Sampling structures of the methods given to `with_methods()` (only
+/// `PickMethod::Alias` for `new()`) are prepared by `publish()` before the
+/// swap. A `SharedPicker` using another method copies the whole table for
+/// building its structure after each publication.
+///
+/// ```
+/// use random_picker::{CompiledTable, SharedTable};
+/// use std::sync::Arc;
+/// let conf: random_picker::Config<String> = "a=1;b=2;c=3".parse().unwrap();
+/// let shared = Arc::new(SharedTable::new(CompiledTable::build(conf).unwrap()));
+/// let hdls: Vec<_> = (0..4)
+///     .map(|_| {
+///         let mut picker = shared.picker(rand::rngs::OsRng);
+///         std::thread::spawn(move || {
+///             while picker.pick(1).unwrap()[0] != "d" {}
+///             picker.generation()
+///         })
+///     })
+///     .collect();
+/// shared.configure("a=1;b=2;c=3;d=4".parse().unwrap()).unwrap();
+/// for hdl in hdls {
+///     assert_eq!(hdl.join().unwrap(), 1);
+/// }
+///
+/// use random_picker::PickMethod;
+/// let conf: random_picker::Config<String> = "a=1;b=2;c=3".parse().unwrap();
+/// let table = CompiledTable::build(conf).unwrap();
+/// let shared = Arc::new(SharedTable::with_methods(table, &[PickMethod::Fixed]));
+/// let mut picker = shared.picker(rand::rngs::OsRng);
+/// picker.picker().set_method(PickMethod::Fixed);
+/// shared.configure("a=1;b=2;c=3;d=4".parse().unwrap()).unwrap();
+/// assert_eq!(picker.pick(2).unwrap().len(), 2);
+/// assert!(Arc::ptr_eq(picker.picker().table(), &shared.load())); // not copied
+/// ```
+#[derive(Debug)]
+pub struct SharedTable<T> {
+    current: Mutex<Arc<CompiledTable<T>>>,
+    generation: AtomicU64,
+    methods: Vec<PickMethod>, // prepared before each publication
+}
+
+impl<T: Clone> SharedTable<T> {
+    /// Creates the shared table of generation 0 for `SharedPicker`s using
+    /// the default `PickMethod::Alias`.
+    #[inline(always)]
+    pub fn new(table: impl Into<Arc<CompiledTable<T>>>) -> Self {
+        Self::with_methods(table, &[PickMethod::Alias])
+    }
+
+    /// Creates the shared table of generation 0, in which the structures
+    /// required by `methods` are prepared for each published table.
+    pub fn with_methods(table: impl Into<Arc<CompiledTable<T>>>, methods: &[PickMethod]) -> Self {
+        let methods = methods.to_vec();
+        Self {
+            current: Mutex::new(prepare_table(table.into(), &methods)),
+            generation: AtomicU64::new(0),
+            methods,
+        }
+    }
+
+    /// Replaces the current table, preparing it for the methods given on creation
+    /// (the table is copied for this if it isn't prepared and it is shared).
+    /// The lock is only held for swapping the pointer; the old table is dropped
+    /// outside of it (if this is the last reference).
+    pub fn publish(&self, table: impl Into<Arc<CompiledTable<T>>>) {
+        let table = prepare_table(table.into(), &self.methods);
+        let old = {
+            let mut current = self.current.lock().unwrap();
+            let old = std::mem::replace(&mut *current, table);
+            self.generation.fetch_add(1, Ordering::Release);
+            old
+        };
+        drop(old);
+    }
+}
+
+impl<T> SharedTable<T> {
+    /// Returns the current table. It takes the mutex on every call.
+    #[inline]
+    pub fn load(&self) -> Arc<CompiledTable<T>> {
+        self.current.lock().unwrap().clone()
+    }
+
+    /// Returns the amount of tables published after creation.
+    #[inline(always)]
+    pub fn generation(&self) -> u64 {
+        self.generation.load(Ordering::Acquire)
+    }
+}
+
+/// Builds the structures required by `methods` which are not available.
+fn prepare_table<T: Clone>(
+    mut table: Arc<CompiledTable<T>>,
+    methods: &[PickMethod],
+) -> Arc<CompiledTable<T>> {
+    for &method in methods {
+        if !table.is_prepared(method) {
+            Arc::make_mut(&mut table).prepare(method);
+        }
+    }
+    table
+}
+
+impl<T: Clone + Eq + Hash> SharedTable<T> {
+    /// Compiles the configuration, then prepares and publishes it (the lock is
+    /// only held for swapping the pointer).
+    pub fn configure(&self, conf: Config<T>) -> Result<(), Error> {
+        self.publish(CompiledTable::build(conf)?);
+        Ok(())
+    }
+
+    /// Creates a `SharedPicker` with its own random source and picking state.
+    pub fn picker<R: RngCore>(self: &Arc<Self>, rng: R) -> SharedPicker<T, R> {
+        let generation = self.generation();
+        SharedPicker {
+            picker: Picker::from_table(self.load(), rng),
+            shared: self.clone(),
+            generation,
+        }
+    }
+}
+
+/// Per-thread picking state (the random source and buffers of `Picker`)
+/// following the latest table of a `SharedTable`.
+pub struct SharedPicker<T: Clone + Eq + Hash, R: RngCore> {
+    picker: Picker<T, R>,
+    shared: Arc<SharedTable<T>>,
+    generation: u64,
+}
+
+impl<T: Clone + Eq + Hash, R: RngCore> SharedPicker<T, R> {
+    /// Switches to the latest table if a new table is published (taking the
+    /// mutex of `SharedTable` in this case). Returns `true` if it is switched.
+    #[inline]
+    pub fn refresh(&mut self) -> bool {
+        let generation = self.shared.generation();
+        if generation == self.generation {
+            return false;
+        }
+        // the generation read while holding the lock matches the table
+        let (table, generation) = {
+            let current = self.shared.current.lock().unwrap();
+            (current.clone(), self.shared.generation())
+        };
+        self.picker.set_table(table);
+        self.generation = generation;
+        true
+    }
+
+    /// Returns the generation of the table being used.
+    #[inline(always)]
+    pub fn generation(&self) -> u64 {
+        self.generation
+    }
+
+    /// Refreshes the table and returns the inner `Picker` for other operations.
+    /// Modifications of its table are not published (the table is copied).
+    #[inline]
+    pub fn picker(&mut self) -> &mut Picker<T, R> {
+        self.refresh();
+        &mut self.picker
+    }
+
+    /// Refreshes the table and picks `amount` of items (see `Picker::pick()`).
+    #[inline]
+    pub fn pick(&mut self, amount: usize) -> Result<Vec<T>, Error> {
+        self.picker().pick(amount)
+    }
+}
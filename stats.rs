@@ -0,0 +1,193 @@
+//! Instrumentation counters of `Picker`, which are only updated with the `stats`
+//! feature. Without it, `Counters` has no field and all of its functions are empty,
+//! so the instrumentation is removed from the compiled code.
+
+#[cfg(feature = "stats")]
+use std::{
+    fmt,
+    time::{Duration, Instant},
+};
+
+/// Snapshot of instrumentation counters of a `Picker` (see `Picker::stats()`),
+/// available with the `stats` feature. Counters are accumulated since the
+/// `Picker` is built or `Picker::reset_stats()` is called; counters of worker
+/// pickers of `Picker::test_freqs_parallel()` and `Picker::test_freqs_batch()`
+/// are added after the test.
+#[cfg(feature = "stats")]
+#[derive(Clone, Copy, PartialEq, Eq, Debug, Default)]
+pub struct PickerStats {
+    /// Bytes requested from the random source.
+    pub rng_bytes: u64,
+    /// Calls of `RngCore::try_fill_bytes()`.
+    pub rng_calls: u64,
+    /// Single draws from the sampling structure, including rejected draws.
+    pub draws: u64,
+    /// Draws of non-repetitive picking rejected because the item was already picked.
+    pub rejected_draws: u64,
+    /// Searches in cumulative grids of `PickMethod::Grid` and `PickMethod::Fixed`.
+    pub grid_searches: u64,
+    /// Grid entries compared by these searches: all entries for short grids
+    /// searched by SIMD counting, about log2(n) for binary search.
+    pub grid_scan_len: u64,
+    /// Rebuilds of the sampling structure required by the current method.
+    pub rebuilds: u64,
+    /// Time spent in these rebuilds.
+    pub rebuild_time: Duration,
+    /// Calls of `Picker::configure()`.
+    pub configures: u64,
+    /// Time spent in `Picker::configure()`, including compiling the
+    /// configuration and rebuilding the sampling structure.
+    pub configure_time: Duration,
+}
+
+#[cfg(feature = "stats")]
+impl PickerStats {
+    /// Average amount of grid entries compared by each grid search.
+    pub fn avg_grid_scan_len(&self) -> f64 {
+        self.grid_scan_len as f64 / self.grid_searches.max(1) as f64
+    }
+
+    /// Fraction of draws rejected in non-repetitive picking.
+    pub fn rejection_rate(&self) -> f64 {
+        self.rejected_draws as f64 / self.draws.max(1) as f64
+    }
+
+    /// Average amount of random bytes requested by each draw.
+    pub fn rng_bytes_per_draw(&self) -> f64 {
+        self.rng_bytes as f64 / self.draws.max(1) as f64
+    }
+
+    fn add(&mut self, other: &Self) {
+        self.rng_bytes += other.rng_bytes;
+        self.rng_calls += other.rng_calls;
+        self.draws += other.draws;
+        self.rejected_draws += other.rejected_draws;
+        self.grid_searches += other.grid_searches;
+        self.grid_scan_len += other.grid_scan_len;
+        self.rebuilds += other.rebuilds;
+        self.rebuild_time += other.rebuild_time;
+        self.configures += other.configures;
+        self.configure_time += other.configure_time;
+    }
+}
+
+#[cfg(feature = "stats")]
+impl fmt::Display for PickerStats {
+    fn fmt(&self, f: &mut fmt::Formatter<'_>) -> fmt::Result {
+        writeln!(f, "RNG bytes: {}", self.rng_bytes)?;
+        writeln!(f, "RNG calls: {}", self.rng_calls)?;
+        writeln!(
+            f,
+            "Draws: {} ({:.2} RNG bytes per draw)",
+            self.draws,
+            self.rng_bytes_per_draw()
+        )?;
+        writeln!(
+            f,
+            "Rejected draws: {} ({:.2}%)",
+            self.rejected_draws,
+            self.rejection_rate() * 100.
+        )?;
+        writeln!(
+            f,
+            "Grid searches: {} (average scan length: {:.2})",
+            self.grid_searches,
+            self.avg_grid_scan_len()
+        )?;
+        writeln!(f, "Rebuilds: {} ({:?})", self.rebuilds, self.rebuild_time)?;
+        write!(
+            f,
+            "Configures: {} ({:?})",
+            self.configures, self.configure_time
+        )
+    }
+}
+
+/// Counters kept by `Picker`, which is zero-sized without the `stats` feature.
+#[derive(Clone, Debug, Default)]
+pub(crate) struct Counters {
+    #[cfg(feature = "stats")]
+    stats: PickerStats,
+}
+
+/// Start time of a timed operation, which is empty without the `stats` feature.
+pub(crate) struct Timer {
+    #[cfg(feature = "stats")]
+    start: Instant,
+}
+
+impl Counters {
+    #[cfg(feature = "stats")]
+    #[inline(always)]
+    pub(crate) fn stats(&self) -> PickerStats {
+        self.stats
+    }
+
+    #[inline(always)]
+    pub(crate) fn add(&mut self, _other: &Self) {
+        #[cfg(feature = "stats")]
+        self.stats.add(&_other.stats);
+    }
+
+    /// Counts a call of `try_fill_bytes()` requesting `bytes`.
+    #[inline(always)]
+    pub(crate) fn rng_fill(&mut self, _bytes: usize) {
+        #[cfg(feature = "stats")]
+        {
+            self.stats.rng_calls += 1;
+            self.stats.rng_bytes += _bytes as u64;
+        }
+    }
+
+    #[inline(always)]
+    pub(crate) fn draws(&mut self, _cnt: usize) {
+        #[cfg(feature = "stats")]
+        {
+            self.stats.draws += _cnt as u64;
+        }
+    }
+
+    #[inline(always)]
+    pub(crate) fn rejected_draw(&mut self) {
+        #[cfg(feature = "stats")]
+        {
+            self.stats.rejected_draws += 1;
+        }
+    }
+
+    /// Counts `cnt` searches in a grid of length `len`.
+    #[inline(always)]
+    pub(crate) fn grid_searches(&mut self, _len: usize, _cnt: usize) {
+        #[cfg(feature = "stats")]
+        {
+            self.stats.grid_searches += _cnt as u64;
+            self.stats.grid_scan_len += (crate::search::scan_len(_len) * _cnt) as u64;
+        }
+    }
+
+    #[inline(always)]
+    pub(crate) fn timer() -> Timer {
+        Timer {
+            #[cfg(feature = "stats")]
+            start: Instant::now(),
+        }
+    }
+
+    #[inline(always)]
+    pub(crate) fn rebuilt(&mut self, _timer: Timer) {
+        #[cfg(feature = "stats")]
+        {
+            self.stats.rebuilds += 1;
+            self.stats.rebuild_time += _timer.start.elapsed();
+        }
+    }
+
+    #[inline(always)]
+    pub(crate) fn configured(&mut self, _timer: Timer) {
+        #[cfg(feature = "stats")]
+        {
+            self.stats.configures += 1;
+            self.stats.configure_time += _timer.start.elapsed();
+        }
+    }
+}
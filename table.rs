@@ -0,0 +1,274 @@
+use crate::{alias::AliasTable, *};
+use std::hash::Hash;
+
+/// Sum of quantized weights used by `PickMethod::Fixed`.
+pub(crate) const FIXED_TOTAL: u64 = 1 << 62;
+
+/// Weight table compiled from `Config` for `Picker`. Items are stored contiguously
+/// in the order of their indexes, and weights and cumulative values are stored
+/// in separate arrays. Many `Picker`s (possibly in different threads) can share
+/// one table through `Arc`, so building them doesn't copy any item.
+///
+/// ```
+/// use random_picker::{CompiledTable, Picker};
+/// use std::sync::Arc;
+/// let conf: random_picker::Config<String> = "a=1;b=2;c=3".parse().unwrap();
+/// let table = Arc::new(CompiledTable::build(conf).unwrap());
+/// assert_eq!(table.len(), 3);
+/// let hdls: Vec<_> = (0..4)
+///     .map(|_| {
+///         let table = table.clone();
+///         std::thread::spawn(move || {
+///             let mut picker = Picker::from_table(table, rand::rngs::OsRng);
+///             picker.pick(2).unwrap()
+///         })
+///     })
+///     .collect();
+/// for hdl in hdls {
+///     assert_eq!(hdl.join().unwrap().len(), 2);
+/// }
+/// ```
+#[derive(Clone, Debug)]
+pub struct CompiledTable<T> {
+    keys: Vec<T>,
+    weights: Vec<f64>,
+    grid: Vec<f64>, // cumulative values of weights, empty if it is not built
+    grid_width: f64,
+    alias: AliasTable, // empty if it is not built
+    fixed: Vec<u64>,   // cumulative values of quantized weights, empty if it is not built
+    inversed: bool,
+    repetitive: bool,
+}
+
+impl<T: Clone + Eq + Hash> CompiledTable<T> {
+    /// Compiles the configuration. Items are moved instead of being cloned;
+    /// impossible choices (p = 0) are excluded.
+    pub fn build(conf: Config<T>) -> Result<Self, Error> {
+        let (inversed, repetitive) = (conf.inversed, conf.repetitive);
+        let (keys, weights): (Vec<_>, Vec<_>) = conf.into_vec_table()?.into_iter().unzip();
+        Ok(Self::from_parts(keys, weights, inversed, repetitive))
+    }
+
+    /// Converts the table back to a configuration, in which weights are the
+    /// result of inversion if `inversed()` is true (so `inversed` is `false`).
+    pub fn to_config(&self) -> Config<T> {
+        Config {
+            table: self
+                .keys
+                .iter()
+                .cloned()
+                .zip(self.weights.iter().copied())
+                .collect(),
+            inversed: false,
+            repetitive: self.repetitive,
+        }
+    }
+}
+
+impl<T> CompiledTable<T> {
+    /// `weights` must be positive (already inversed if `inversed` is true).
+    pub(crate) fn from_parts(
+        keys: Vec<T>,
+        weights: Vec<f64>,
+        inversed: bool,
+        repetitive: bool,
+    ) -> Self {
+        assert!(!keys.is_empty() && keys.len() == weights.len());
+        let mut table = Self {
+            keys,
+            weights,
+            grid: Vec::new(),
+            grid_width: 0.,
+            alias: AliasTable::default(),
+            fixed: Vec::new(),
+            inversed,
+            repetitive,
+        };
+        table.rebuild_grid_from(0);
+        table.alias.rebuild(table.weights.iter().copied());
+        table
+    }
+
+    /// Returns the amount of possible choices (p > 0).
+    #[inline(always)]
+    pub fn len(&self) -> usize {
+        self.keys.len()
+    }
+
+    /// Always returns `false`, because an empty table can't be compiled.
+    #[inline(always)]
+    pub fn is_empty(&self) -> bool {
+        self.keys.is_empty()
+    }
+
+    /// Returns the item of index `i`.
+    #[inline(always)]
+    pub fn key(&self, i: usize) -> Option<&T> {
+        self.keys.get(i)
+    }
+
+    /// Returns all items in the order of their indexes.
+    #[inline(always)]
+    pub fn keys(&self) -> &[T] {
+        &self.keys
+    }
+
+    /// Returns weights in the order of indexes (inversion has been done if `inversed()`).
+    #[inline(always)]
+    pub fn weights(&self) -> &[f64] {
+        &self.weights
+    }
+
+    /// Returns the sum of all weights.
+    #[inline(always)]
+    pub fn total_weight(&self) -> f64 {
+        self.grid_width
+    }
+
+    #[inline(always)]
+    pub fn inversed(&self) -> bool {
+        self.inversed
+    }
+
+    #[inline(always)]
+    pub fn repetitive(&self) -> bool {
+        self.repetitive
+    }
+
+    /// Returns `true` if all items have equal weight values.
+    pub fn is_fair(&self) -> bool {
+        self.weights.windows(2).all(|w| w[0] == w[1])
+    }
+
+    /// Cumulative grid, which is empty if it is invalidated by `set_weight()`.
+    #[inline(always)]
+    pub(crate) fn grid(&self) -> &[f64] {
+        &self.grid
+    }
+
+    /// Alias table, which is empty if it is invalidated by `set_weight()`.
+    #[inline(always)]
+    pub(crate) fn alias(&self) -> &AliasTable {
+        &self.alias
+    }
+
+    /// Cumulative grid of quantized weights, ending with `FIXED_TOTAL`.
+    /// It is empty if it is not built by `prepare()`.
+    #[inline(always)]
+    pub(crate) fn fixed(&self) -> &[u64] {
+        &self.fixed
+    }
+
+    /// Checks if the structure required by `method` is available.
+    #[inline(always)]
+    pub fn is_prepared(&self, method: PickMethod) -> bool {
+        match method {
+            PickMethod::Alias => !self.alias.is_empty(),
+            PickMethod::Grid => !self.grid.is_empty(),
+            PickMethod::Fixed => !self.fixed.is_empty(),
+            PickMethod::Tree => true, // the tree belongs to `Picker`
+        }
+    }
+
+    /// Builds the structure required by `method` if it is not available (only the
+    /// alias table is built by `build()`). Do it before sharing the table, so that
+    /// `Picker`s using `method` don't have to copy the table for building it.
+    pub fn prepare(&mut self, method: PickMethod) {
+        if self.is_prepared(method) {
+            return;
+        }
+        match method {
+            PickMethod::Alias => self.alias.rebuild(self.weights.iter().copied()),
+            PickMethod::Grid => self.rebuild_grid_from(0),
+            PickMethod::Fixed => self.rebuild_fixed(),
+            PickMethod::Tree => (),
+        }
+    }
+
+    /// Modifies a weight and invalidates sampling structures, which are rebuilt
+    /// by `prepare()` when they are needed. Returns the difference of the weight.
+    pub(crate) fn set_weight(&mut self, i: usize, weight: f64) -> f64 {
+        let delta = weight - self.weights[i];
+        self.weights[i] = weight;
+        self.invalidate(delta);
+        delta
+    }
+
+    /// Appends an item (`weight` must be positive), and invalidates sampling structures.
+    pub(crate) fn push(&mut self, key: T, weight: f64) {
+        self.keys.push(key);
+        self.weights.push(weight);
+        self.invalidate(weight);
+    }
+
+    /// Removes the item of index `i`, which is replaced by the last item,
+    /// and invalidates sampling structures. The table must have other items.
+    pub(crate) fn swap_remove(&mut self, i: usize) -> (T, f64) {
+        assert!(self.len() > 1);
+        let weight = self.weights.swap_remove(i);
+        self.invalidate(-weight);
+        (self.keys.swap_remove(i), weight)
+    }
+
+    /// Replaces each weight `w` by `1 / w`, and toggles `inversed`.
+    pub(crate) fn invert(&mut self) {
+        self.weights.iter_mut().for_each(|w| *w = 1. / *w);
+        self.inversed = !self.inversed;
+        let total = self.weights.iter().sum::<f64>();
+        self.invalidate(total - self.grid_width);
+    }
+
+    #[inline(always)]
+    pub(crate) fn set_repetitive(&mut self, repetitive: bool) {
+        self.repetitive = repetitive;
+    }
+
+    #[inline(always)]
+    fn invalidate(&mut self, delta: f64) {
+        self.grid.clear();
+        self.alias.clear();
+        self.fixed.clear();
+        self.grid_width += delta;
+    }
+
+    /// Quantizes weights into integers whose sum is exactly `FIXED_TOTAL`, and
+    /// builds the cumulative grid of them. Each item gets at least 1; the rounding
+    /// error (less than 1 for each item) is compensated by the largest item.
+    fn rebuild_fixed(&mut self) {
+        let total: f64 = self.weights.iter().sum();
+        let scale = FIXED_TOTAL as f64 / total;
+        let (mut sum, mut i_max, mut w_max) = (0u64, 0, 0.);
+        self.fixed.clear();
+        for (i, &w) in self.weights.iter().enumerate() {
+            let q = ((w * scale) as u64).max(1);
+            sum += q;
+            self.fixed.push(q);
+            if w > w_max {
+                (i_max, w_max) = (i, w);
+            }
+        }
+        // the largest item is not less than FIXED_TOTAL / n, which is much larger than n
+        self.fixed[i_max] = (self.fixed[i_max] + FIXED_TOTAL) - sum;
+        let mut cur = 0;
+        for v in self.fixed.iter_mut() {
+            cur += *v;
+            *v = cur;
+        }
+    }
+
+    /// Recalculates values in the cumulative grid from index `start`.
+    fn rebuild_grid_from(&mut self, start: usize) {
+        let start = if self.grid.len() < self.weights.len() {
+            0 // it was invalidated
+        } else {
+            start
+        };
+        self.grid.resize(self.weights.len(), 0.);
+        let mut cur = if start > 0 { self.grid[start - 1] } else { 0. };
+        for (g, val) in self.grid[start..].iter_mut().zip(&self.weights[start..]) {
+            cur += val;
+            *g = cur;
+        }
+        self.grid_width = cur;
+    }
+}
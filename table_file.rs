@@ -0,0 +1,304 @@
+use crate::{alias::AliasTable, *};
+use rand::RngCore;
+use std::{
+    collections::HashSet,
+    fs::File,
+    io::{self, Read, Seek, SeekFrom, Write},
+    path::Path,
+    sync::Arc,
+};
+
+/// Magic bytes at the beginning of a binary table file.
+const FILE_MAGIC: &[u8; 8] = b"RPTABLE\0";
+/// Version of the binary table format, increased on incompatible changes.
+const FILE_VERSION: u32 = 1;
+/// Length of the header: magic, version, flags, `len`, `names_len`.
+const HEADER_LEN: u64 = 32;
+
+const FLAG_REPETITIVE: u32 = 1 << 0;
+const FLAG_INVERSED: u32 = 1 << 1;
+const FLAG_ALIAS: u32 = 1 << 2;
+const FLAG_FAIR: u32 = 1 << 3;
+
+impl CompiledTable<String> {
+    /// Writes the table in the binary format read by `TableFile`.
+    ///
+    /// The format (little-endian, all sections aligned to 8 bytes) consists of
+    /// a header (magic `RPTABLE\0`, version `u32`, flags `u32`, item amount `n`
+    /// as `u64`, total length of names as `u64`), normalized weights (`n` of
+    /// `f64`, with inversion done), the alias table (`n` pairs of `u64`
+    /// threshold and index, present if flag 4 is set), name offsets (`n + 1`
+    /// of `u64`), and UTF-8 names stored one after another. Other flags are
+    /// 1 for `repetitive`, 2 for `inversed` and 8 for `is_fair()`.
+    pub fn write_binary<W: Write>(&self, mut writer: W) -> Result<(), Error> {
+        let mut alias = self.alias().clone();
+        if alias.is_empty() {
+            alias.rebuild(self.weights().iter().copied()); // invalidated by `set_weight()`
+        }
+        let mut flags = FLAG_ALIAS;
+        if self.repetitive() {
+            flags |= FLAG_REPETITIVE;
+        }
+        if self.inversed() {
+            flags |= FLAG_INVERSED;
+        }
+        if self.is_fair() {
+            flags |= FLAG_FAIR;
+        }
+        let names_len: usize = self.keys().iter().map(|k| k.len()).sum();
+
+        let mut w = |bytes: &[u8]| writer.write_all(bytes).map_err(Error::IoError);
+        w(FILE_MAGIC)?;
+        w(&FILE_VERSION.to_le_bytes())?;
+        w(&flags.to_le_bytes())?;
+        w(&(self.len() as u64).to_le_bytes())?;
+        w(&(names_len as u64).to_le_bytes())?;
+        let total = self.total_weight();
+        for &v in self.weights() {
+            w(&(v / total).to_le_bytes())?;
+        }
+        for (threshold, i) in alias.columns() {
+            w(&threshold.to_le_bytes())?;
+            w(&(i as u64).to_le_bytes())?;
+        }
+        let mut offset = 0;
+        w(&0u64.to_le_bytes())?;
+        for k in self.keys() {
+            offset += k.len() as u64;
+            w(&offset.to_le_bytes())?;
+        }
+        for k in self.keys() {
+            w(k.as_bytes())?;
+        }
+        writer.flush().map_err(Error::IoError)
+    }
+}
+
+/// Binary table file written by `CompiledTable::write_binary()`, opened for
+/// random access. Only the header is read by `open()`, and `pick()` reads a few
+/// entries for each picked item, so the latency of a process which opens the
+/// file and picks once doesn't depend on the table size. `load()` reads the
+/// whole table for other purposes.
+///
+/// ```
+/// use random_picker::{CompiledTable, TableFile};
+/// let conf: random_picker::Config<String> = "a=1;b=2;c=3;d=0".parse().unwrap();
+/// let table = CompiledTable::build(conf).unwrap();
+/// let path = std::env::temp_dir().join("random-picker-doctest.rpt");
+/// table.write_binary(std::fs::File::create(&path).unwrap()).unwrap();
+///
+/// let mut file = TableFile::open(&path).unwrap();
+/// assert_eq!(file.len(), 3);
+/// let picks = file.pick(2, &mut rand::thread_rng()).unwrap();
+/// assert!(picks[0] != picks[1] && picks.iter().all(|k| table.keys().contains(k)));
+///
+/// let loaded = file.load().unwrap();
+/// assert_eq!(loaded.keys(), table.keys());
+/// assert!((loaded.weights()[0] - table.weights()[0] / 6.).abs() < 1e-15);
+/// # std::fs::remove_file(&path).unwrap();
+/// ```
+#[derive(Debug)]
+pub struct TableFile {
+    file: File,
+    len: usize,
+    flags: u32,
+    names_len: u64,
+}
+
+impl TableFile {
+    /// Opens the file and checks its header and length. Returns
+    /// `Error::IoError` of `io::ErrorKind::InvalidData` if it is not
+    /// a binary table file of a supported version.
+    pub fn open(path: impl AsRef<Path>) -> Result<Self, Error> {
+        let mut file = File::open(path).map_err(Error::IoError)?;
+        let mut header = [0u8; HEADER_LEN as usize];
+        file.read_exact(&mut header).map_err(|_| invalid_data())?;
+        let u32_at = |i: usize| u32::from_le_bytes(header[i..i + 4].try_into().unwrap());
+        let u64_at = |i: usize| u64::from_le_bytes(header[i..i + 8].try_into().unwrap());
+        if &header[..8] != FILE_MAGIC || u32_at(8) != FILE_VERSION {
+            return Err(invalid_data());
+        }
+        let file_len = file.metadata().map_err(Error::IoError)?.len();
+        let (len, names_len) = (u64_at(16), u64_at(24));
+        // each item takes at least 16 bytes, which also prevents overflows
+        if len == 0 || len > file_len / 16 || names_len > file_len {
+            return Err(invalid_data());
+        }
+        let table_file = Self {
+            file,
+            len: len as usize,
+            flags: u32_at(12),
+            names_len,
+        };
+        if file_len != table_file.pos_names() + names_len {
+            return Err(invalid_data());
+        }
+        Ok(table_file)
+    }
+
+    /// Returns the amount of items.
+    #[inline(always)]
+    pub fn len(&self) -> usize {
+        self.len
+    }
+
+    /// Always returns `false`, because an empty table can't be compiled.
+    #[inline(always)]
+    pub fn is_empty(&self) -> bool {
+        self.len == 0
+    }
+
+    #[inline(always)]
+    pub fn inversed(&self) -> bool {
+        self.flags & FLAG_INVERSED != 0
+    }
+
+    #[inline(always)]
+    pub fn repetitive(&self) -> bool {
+        self.flags & FLAG_REPETITIVE != 0
+    }
+
+    /// Returns `CompiledTable::is_fair()` of the written table.
+    #[inline(always)]
+    pub fn is_fair(&self) -> bool {
+        self.flags & FLAG_FAIR != 0
+    }
+
+    /// Picks `amount` items by the alias method, with the same distribution
+    /// as `Picker::pick()`. In non-repetitive mode, rejection sampling is done
+    /// while picked items take less than half of the total weight, then the
+    /// whole table is loaded to pick the remaining items.
+    pub fn pick<R: RngCore>(&mut self, amount: usize, rng: &mut R) -> Result<Vec<String>, Error> {
+        if !self.repetitive() && amount > self.len {
+            return Err(Error::InvalidAmount);
+        }
+        if self.flags & FLAG_ALIAS == 0 {
+            let mut picker = Picker::from_table(Arc::new(self.load()?), rng);
+            return picker.pick(amount);
+        }
+
+        let mut indexes = Vec::with_capacity(amount);
+        let mut picked = HashSet::new();
+        let mut picked_width = 0.;
+        while indexes.len() < amount {
+            if !self.repetitive() && picked_width * 2. >= 1. {
+                let mut picker = Picker::from_table(Arc::new(self.load()?), rng);
+                picker.pick_indexes_after(&indexes, amount)?;
+                let keys = picker.keys();
+                return Ok(picker
+                    .picked_indexes()
+                    .iter()
+                    .map(|&i| keys[i].clone())
+                    .collect());
+            }
+            let mut bytes = [0u8; 8];
+            rng.try_fill_bytes(&mut bytes).map_err(Error::RandError)?;
+            let bits = u64::from_ne_bytes(bytes);
+            let col = AliasTable::column_of(bits, self.len);
+            let [threshold, alias] = self.read_u64s(self.pos_alias() + 16 * col as u64)?;
+            let i = if AliasTable::accepts(bits, threshold) {
+                col
+            } else if alias < self.len as u64 {
+                alias as usize
+            } else {
+                return Err(invalid_data());
+            };
+            if !self.repetitive() {
+                if !picked.insert(i) {
+                    continue;
+                }
+                let [weight] = self.read_u64s(self.pos_weights() + 8 * i as u64)?;
+                picked_width += f64::from_bits(weight);
+            }
+            indexes.push(i);
+        }
+        indexes.iter().map(|&i| self.read_name(i)).collect()
+    }
+
+    /// Reads the whole table.
+    pub fn load(&mut self) -> Result<CompiledTable<String>, Error> {
+        let n = self.len;
+        let mut buf = vec![0u8; 8 * n];
+        self.read_at(self.pos_weights(), &mut buf)?;
+        let weights: Vec<f64> = (buf.chunks_exact(8))
+            .map(|b| f64::from_le_bytes(b.try_into().unwrap()))
+            .collect();
+        if weights.iter().any(|&v| v.is_nan() || v <= 0.) {
+            return Err(invalid_data());
+        }
+
+        buf.resize(8 * (n + 1), 0);
+        self.read_at(self.pos_offsets(), &mut buf)?;
+        let offsets: Vec<usize> = (buf.chunks_exact(8))
+            .map(|b| u64::from_le_bytes(b.try_into().unwrap()) as usize)
+            .collect();
+        let mut names = vec![0u8; self.names_len as usize];
+        self.read_at(self.pos_names(), &mut names)?;
+        let names = String::from_utf8(names).map_err(|_| invalid_data())?;
+        let mut keys = Vec::with_capacity(n);
+        for pair in offsets.windows(2) {
+            let name = names.get(pair[0]..pair[1]).ok_or_else(invalid_data)?;
+            keys.push(name.to_string());
+        }
+        Ok(CompiledTable::from_parts(
+            keys,
+            weights,
+            self.inversed(),
+            self.repetitive(),
+        ))
+    }
+
+    fn read_name(&mut self, i: usize) -> Result<String, Error> {
+        let [start, end] = self.read_u64s(self.pos_offsets() + 8 * i as u64)?;
+        if start > end || end > self.names_len {
+            return Err(invalid_data());
+        }
+        let mut name = vec![0u8; (end - start) as usize];
+        self.read_at(self.pos_names() + start, &mut name)?;
+        String::from_utf8(name).map_err(|_| invalid_data())
+    }
+
+    fn read_u64s<const N: usize>(&mut self, pos: u64) -> Result<[u64; N], Error> {
+        let mut bytes = [0u8; 16];
+        self.read_at(pos, &mut bytes[..8 * N])?;
+        Ok(std::array::from_fn(|i| {
+            u64::from_le_bytes(bytes[8 * i..8 * i + 8].try_into().unwrap())
+        }))
+    }
+
+    fn read_at(&mut self, pos: u64, buf: &mut [u8]) -> Result<(), Error> {
+        self.file
+            .seek(SeekFrom::Start(pos))
+            .map_err(Error::IoError)?;
+        self.file.read_exact(buf).map_err(Error::IoError)
+    }
+
+    #[inline(always)]
+    fn pos_weights(&self) -> u64 {
+        HEADER_LEN
+    }
+
+    #[inline(always)]
+    fn pos_alias(&self) -> u64 {
+        self.pos_weights() + 8 * self.len as u64
+    }
+
+    #[inline(always)]
+    fn pos_offsets(&self) -> u64 {
+        let alias_len = if self.flags & FLAG_ALIAS != 0 { 16 } else { 0 };
+        self.pos_alias() + alias_len * self.len as u64
+    }
+
+    #[inline(always)]
+    fn pos_names(&self) -> u64 {
+        self.pos_offsets() + 8 * (self.len as u64 + 1)
+    }
+}
+
+#[inline(always)]
+fn invalid_data() -> Error {
+    Error::IoError(io::Error::new(
+        io::ErrorKind::InvalidData,
+        "Invalid binary table file",
+    ))
+}
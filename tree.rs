@@ -0,0 +1,96 @@
+/// Fenwick tree (binary indexed tree) of weights, supporting O(log n) updates
+/// and O(log n) searching of the cumulative grid.
+#[derive(Clone, Debug, Default)]
+pub(crate) struct FenwickTree {
+    tree: Vec<f64>,  // 1-based, tree[0] is unused
+    top_step: usize, // highest power of 2 not exceeding len
+}
+
+impl FenwickTree {
+    /// Rebuilds the tree in O(n), reusing allocated buffers.
+    pub(crate) fn rebuild(&mut self, weights: impl ExactSizeIterator<Item = f64>) {
+        let n = weights.len();
+        self.tree.clear();
+        self.tree.reserve(n + 1);
+        self.tree.push(0.);
+        self.tree.extend(weights);
+        for i in 1..=n {
+            let j = i + (i & i.wrapping_neg());
+            if j <= n {
+                self.tree[j] += self.tree[i];
+            }
+        }
+        self.top_step = if n > 0 { 1 << n.ilog2() } else { 0 };
+    }
+
+    /// Appends a weight in O(log n).
+    pub(crate) fn push(&mut self, weight: f64) {
+        if self.tree.is_empty() {
+            self.tree.push(0.);
+        }
+        // the new node covers indexes `(i - lowbit(i), i]` (1-based)
+        let i = self.tree.len();
+        let covered = self.prefix_sum(i - 1) - self.prefix_sum(i - (i & i.wrapping_neg()));
+        self.tree.push(weight + covered);
+        self.top_step = 1 << self.len().ilog2();
+    }
+
+    /// Removes the last weight in O(1), because no other node covers it.
+    pub(crate) fn pop(&mut self) {
+        if self.tree.len() > 1 {
+            self.tree.pop();
+            let n = self.len();
+            self.top_step = if n > 0 { 1 << n.ilog2() } else { 0 };
+        }
+    }
+
+    #[inline(always)]
+    pub(crate) fn len(&self) -> usize {
+        self.tree.len().saturating_sub(1)
+    }
+
+    /// Adds `delta` to the weight at `index` (0-based).
+    #[inline]
+    pub(crate) fn add(&mut self, index: usize, delta: f64) {
+        let mut i = index + 1;
+        while i < self.tree.len() {
+            self.tree[i] += delta;
+            i += i & i.wrapping_neg();
+        }
+    }
+
+    /// Sum of weights of indexes `0..end`.
+    #[inline]
+    pub(crate) fn prefix_sum(&self, end: usize) -> f64 {
+        let mut i = end;
+        let mut sum = 0.;
+        while i > 0 {
+            sum += self.tree[i];
+            i &= i - 1;
+        }
+        sum
+    }
+
+    #[inline(always)]
+    pub(crate) fn total(&self) -> f64 {
+        self.prefix_sum(self.len())
+    }
+
+    /// Returns the first index whose cumulative value is not less than `val`,
+    /// like searching in the cumulative grid used by `Picker`.
+    #[inline]
+    pub(crate) fn search(&self, mut val: f64) -> usize {
+        let n = self.len();
+        let mut pos = 0;
+        let mut step = self.top_step;
+        while step > 0 {
+            let next = pos + step;
+            if next <= n && self.tree[next] < val {
+                pos = next;
+                val -= self.tree[next];
+            }
+            step >>= 1;
+        }
+        pos.min(n - 1)
+    }
+}